@@ -0,0 +1,184 @@
+/**
+ * @file benchmarks/micro_bench.cpp
+ * @brief Definitions for the benchmarks of single components of the streaming pipeline.
+ */
+// standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// local includes
+#include "micro_bench.h"
+#include "src/platform/common.h"
+#include "src/thread_safe.h"
+
+extern "C" {
+#include "src/rswrapper.h"
+}
+
+using namespace std::literals;
+
+namespace stream::fec {
+  reed_solomon *codec_for(size_t data_shards, size_t parity_shards);
+}
+
+namespace micro_bench {
+  namespace {
+    /**
+     * @brief Measure the average time of a call.
+     * @tparam Unit The unit of the result, such as `std::micro`.
+     * @param iterations The number of times to call the function.
+     * @param function The function to measure.
+     * @return The average time of a call.
+     */
+    template<class Unit, class F>
+    double measure(int iterations, F &&function) {
+      auto start = std::chrono::steady_clock::now();
+      for (int x = 0; x < iterations; ++x) {
+        function();
+      }
+
+      return std::chrono::duration<double, Unit>(std::chrono::steady_clock::now() - start).count() / iterations;
+    }
+
+    /**
+     * @brief Compare the latency of a FEC block with a new codec, and with a cached one.
+     */
+    void fec(nlohmann::json &results) {
+      reed_solomon_init();
+
+      // A typical FEC block: 1 Mbit frame of 1392 byte packets at the default 20% FEC
+      constexpr size_t data_shards = 90;
+      constexpr size_t parity_shards = 18;
+      constexpr size_t blocksize = 1392 + 16;
+      constexpr int iterations = 200;
+
+      std::vector<std::uint8_t> buffer((data_shards + parity_shards) * blocksize);
+      for (size_t x = 0; x < buffer.size(); ++x) {
+        buffer[x] = (std::uint8_t) (x * 31);
+      }
+
+      std::vector<std::uint8_t *> shards_p(data_shards + parity_shards);
+      for (size_t x = 0; x < shards_p.size(); ++x) {
+        shards_p[x] = &buffer[x * blocksize];
+      }
+
+      auto uncached_us = measure<std::micro>(iterations, [&]() {
+        auto rs = reed_solomon_new(data_shards, parity_shards);
+        reed_solomon_encode(rs, shards_p.data(), shards_p.size(), blocksize);
+        reed_solomon_release(rs);
+      });
+      auto cached_us = measure<std::micro>(iterations, [&]() {
+        reed_solomon_encode(stream::fec::codec_for(data_shards, parity_shards), shards_p.data(), shards_p.size(), blocksize);
+      });
+
+      results["uncached_us_per_block"] = uncached_us;
+      results["cached_us_per_block"] = cached_us;
+      std::cout << "FEC block of "sv << data_shards << '+' << parity_shards << " shards: "sv
+                << uncached_us << "us uncached, "sv << cached_us << "us cached"sv << std::endl;
+    }
+
+    /**
+     * @brief Measure how late the high precision timer wakes up from the 1ms sleeps of video pacing.
+     */
+    void timer(nlohmann::json &results) {
+      auto timer = platf::create_high_precision_timer();
+      if (!timer || !*timer) {
+        std::cerr << "The high precision timer isn't available"sv << std::endl;
+        return;
+      }
+
+      constexpr int iterations = 1000;
+      std::vector<double> overshoot_us;
+      overshoot_us.reserve(iterations);
+      for (int x = 0; x < iterations; ++x) {
+        auto due = std::chrono::steady_clock::now() + 1ms;
+        timer->sleep_for(due - std::chrono::steady_clock::now());
+        overshoot_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - due).count());
+      }
+
+      std::sort(std::begin(overshoot_us), std::end(overshoot_us));
+      auto percentile = [&](double p) {
+        return overshoot_us[(size_t) (p * (overshoot_us.size() - 1))];
+      };
+
+      results["overshoot_us"] = {
+        {"min", overshoot_us.front()},
+        {"p50", percentile(0.5)},
+        {"p90", percentile(0.9)},
+        {"p99", percentile(0.99)},
+        {"max", overshoot_us.back()},
+      };
+      std::cout << "Sleep overshoot min/p50/p90/p99/max: "sv << overshoot_us.front() << '/' << percentile(0.5) << '/'
+                << percentile(0.9) << '/' << percentile(0.99) << '/' << overshoot_us.back() << " us"sv << std::endl;
+    }
+
+    /**
+     * @brief Measure the throughput of the queues between the pipeline threads, as producers are added.
+     */
+    void queue(nlohmann::json &results) {
+      constexpr int elements_per_producer = 50000;
+
+      // Every element is popped, so the measured rate is the sustainable throughput
+      auto ns_per_element = [&](auto &queue, int producers) {
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (int x = 0; x < producers; ++x) {
+          threads.emplace_back([&queue]() {
+            for (int y = 0; y < elements_per_producer; ++y) {
+              queue.raise(y);
+            }
+          });
+        }
+
+        for (int x = 0; x < producers * elements_per_producer; ++x) {
+          queue.pop();
+        }
+
+        for (auto &thread : threads) {
+          thread.join();
+        }
+
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (producers * elements_per_producer);
+      };
+
+      for (int producers : {1, 2, 4}) {
+        safe::queue_t<int> queue {32, safe::overflow_e::block};
+        auto ns = ns_per_element(queue, producers);
+
+        results["queue_ns_per_element"][std::to_string(producers)] = ns;
+        std::cout << "queue_t with "sv << producers << " producers: "sv << ns << "ns per element"sv << std::endl;
+      }
+
+      safe::spsc_queue_t<int> queue {32, safe::overflow_e::block};
+      auto ns = ns_per_element(queue, 1);
+
+      results["spsc_queue_ns_per_element"] = ns;
+      std::cout << "spsc_queue_t with 1 producer: "sv << ns << "ns per element"sv << std::endl;
+    }
+  }  // namespace
+
+  int run(std::string_view name, nlohmann::json &results) {
+    static const std::map<std::string_view, void (*)(nlohmann::json &)> benchmarks {
+      {"fec"sv, fec},
+      {"queue"sv, queue},
+      {"timer"sv, timer},
+    };
+
+    auto it = benchmarks.find(name);
+    if (it == std::end(benchmarks)) {
+      return -1;
+    }
+
+    results["benchmark"] = name;
+    it->second(results);
+
+    return 0;
+  }
+}  // namespace micro_bench
@@ -0,0 +1,21 @@
+/**
+ * @file benchmarks/micro_bench.h
+ * @brief Declarations for the benchmarks of single components of the streaming pipeline.
+ */
+#pragma once
+
+// standard includes
+#include <string_view>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+namespace micro_bench {
+  /**
+   * @brief Run the benchmark of a single component and print what it measured.
+   * @param name The name of the benchmark.
+   * @param results Receives the measurements.
+   * @return 0 on success, -1 if there is no benchmark with that name.
+   */
+  int run(std::string_view name, nlohmann::json &results);
+}  // namespace micro_bench
@@ -0,0 +1,419 @@
+/**
+ * @file benchmarks/sunshine_bench.cpp
+ * @brief End-to-end benchmark of the streaming pipeline, without a GPU, a display or a client.
+ * @details A synthetic display feeds the software encoder, and the encoded frames go through the
+ * real packetization, FEC, encryption and pacing of a stream session to a loopback socket.
+ * With `--micro`, a single component is measured on its own instead.
+ */
+// standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+
+// platform includes
+#include <sys/socket.h>
+
+// lib includes
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+
+extern "C" {
+#include <moonlight-common-c/src/Limelight-internal.h>
+}
+
+// local includes
+#include "micro_bench.h"
+#include "src/audio.h"
+#include "src/config.h"
+#include "src/crypto.h"
+#include "src/globals.h"
+#include "src/input.h"
+#include "src/logging.h"
+#include "src/network.h"
+#include "src/platform/common.h"
+#include "src/rtsp.h"
+#include "src/stat_trackers.h"
+#include "src/stats.h"
+#include "src/stream.h"
+#include "src/utility.h"
+#include "src/video.h"
+
+extern "C" {
+#include "src/rswrapper.h"
+}
+
+using namespace std::literals;
+namespace asio = boost::asio;
+using asio::ip::udp;
+
+namespace {
+  /**
+   * @brief What to benchmark, set from the command line.
+   */
+  struct options_t {
+    int width = 1920;
+    int height = 1080;
+    int fps = 60;
+    int bitrate = 20000;  ///< In Kbps
+    int fec = 20;  ///< Percentage of FEC shards
+    bool encrypt = false;
+    int codec = 0;  ///< 0 for H.264, 1 for HEVC, 2 for AV1
+    int duration = 10;  ///< In seconds
+    int port = 57989;
+    std::string pattern = "text";  ///< Test pattern of the synthetic display
+    std::string micro;  ///< Component to benchmark on its own, instead of streaming
+    std::string json;  ///< File to write the results to, if any
+  };
+
+  void print_help(const char *name) {
+    std::cout
+      << "Usage: "sv << name << " [options]"sv << std::endl
+      << "    --width=<pixels>       Width of the stream, default 1920"sv << std::endl
+      << "    --height=<pixels>      Height of the stream, default 1080"sv << std::endl
+      << "    --fps=<frames>         Frame rate of the stream, default 60"sv << std::endl
+      << "    --bitrate=<kbps>       Bitrate of the stream, default 20000"sv << std::endl
+      << "    --fec=<percent>        Percentage of FEC shards, default 20"sv << std::endl
+      << "    --encrypt=<0|1>        Encrypt the video stream, default 0"sv << std::endl
+      << "    --codec=<0|1|2>        0 for H.264, 1 for HEVC, 2 for AV1, default 0"sv << std::endl
+      << "    --duration=<seconds>   How long to stream for, default 10"sv << std::endl
+      << "    --port=<port>          Base port of the streaming sockets, default 57989"sv << std::endl
+      << "    --pattern=<pattern>    desktop, text, noise or damage, default text"sv << std::endl
+      << "    --micro=<component>    Benchmark a single component instead: fec, queue or timer"sv << std::endl
+      << "    --json=<file>          Write the results to a JSON file"sv << std::endl;
+  }
+
+  /**
+   * @brief Parse `--name=value` arguments.
+   * @return 0 on success, 1 if the help was requested, -1 on invalid arguments.
+   */
+  int parse_options(int argc, char *argv[], options_t &options) {
+    std::map<std::string_view, int *> ints {
+      {"width"sv, &options.width},
+      {"height"sv, &options.height},
+      {"fps"sv, &options.fps},
+      {"bitrate"sv, &options.bitrate},
+      {"fec"sv, &options.fec},
+      {"codec"sv, &options.codec},
+      {"duration"sv, &options.duration},
+      {"port"sv, &options.port},
+    };
+
+    for (int x = 1; x < argc; ++x) {
+      std::string_view arg {argv[x]};
+      if (arg == "--help"sv || arg == "-h"sv) {
+        return 1;
+      }
+
+      auto eq = arg.find('=');
+      if (!arg.starts_with("--"sv) || eq == std::string_view::npos) {
+        std::cerr << "Invalid argument: "sv << arg << std::endl;
+        return -1;
+      }
+
+      auto name = arg.substr(2, eq - 2);
+      auto value = arg.substr(eq + 1);
+
+      if (name == "json"sv) {
+        options.json = value;
+      } else if (name == "pattern"sv) {
+        options.pattern = value;
+      } else if (name == "micro"sv) {
+        options.micro = value;
+      } else if (name == "encrypt"sv) {
+        options.encrypt = util::from_view(value) != 0;
+      } else if (auto it = ints.find(name); it != std::end(ints)) {
+        *it->second = (int) util::from_view(value);
+      } else {
+        std::cerr << "Unknown option: "sv << name << std::endl;
+        return -1;
+      }
+    }
+
+    if (options.width <= 0 || options.height <= 0 || options.fps <= 0 || options.bitrate <= 0 || options.duration <= 0 ||
+        options.fec < 0 || options.fec > 255 || options.codec < 0 || options.codec > 2 ||
+        (options.pattern != "desktop"sv && options.pattern != "text"sv && options.pattern != "noise"sv && options.pattern != "damage"sv)) {
+      std::cerr << "Option out of range"sv << std::endl;
+      return -1;
+    }
+
+    return 0;
+  }
+
+  /**
+   * @brief What the loopback receiver saw of the video stream.
+   */
+  struct receiver_stats_t {
+    std::uint64_t packets = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t frames = 0;
+
+    // Time from the first to the last packet of a frame, in ms
+    stat_trackers::histogram_t frame_completion;
+  };
+
+  /**
+   * @brief Ping the session until it streams, then tally the video packets until stopped.
+   * @details This stands in for Moonlight, but doesn't reassemble or decode anything.
+   */
+  void receive(udp::socket &sock, const udp::endpoint &video_port, const udp::endpoint &audio_port, const std::string &ping_payload, bool encrypted, std::atomic_bool &stopping, receiver_stats_t &stats) {
+    SS_PING ping {};
+    std::copy_n(ping_payload.data(), std::min(ping_payload.size(), sizeof(ping.payload)), ping.payload);
+
+    // Pings go out from the same socket, so both streams are sent back to it, but only video is enabled
+    auto send_pings = [&]() {
+      ping.sequenceNumber = util::endian::big(util::endian::big(ping.sequenceNumber) + 1);
+      boost::system::error_code ec;
+      sock.send_to(asio::buffer(&ping, sizeof(ping)), video_port, 0, ec);
+      sock.send_to(asio::buffer(&ping, sizeof(ping)), audio_port, 0, ec);
+    };
+
+    send_pings();
+    auto next_ping = std::chrono::steady_clock::now() + 100ms;
+
+    std::array<char, 2048> buffer;
+    std::optional<std::uint32_t> frame_index;
+    std::chrono::steady_clock::time_point frame_start;
+    std::chrono::steady_clock::time_point frame_end;
+
+    while (!stopping.load(std::memory_order_relaxed)) {
+      if (!stats.packets && std::chrono::steady_clock::now() > next_ping) {
+        send_pings();
+        next_ping += 100ms;
+      }
+
+      udp::endpoint peer;
+      boost::system::error_code ec;
+      auto bytes = sock.receive_from(asio::buffer(buffer), peer, 0, ec);
+      if (ec || peer != video_port) {
+        continue;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+
+      std::uint32_t index;
+      if (encrypted) {
+        // The frame number follows the 12 byte IV of the unencrypted prefix
+        if (bytes < 32) {
+          continue;
+        }
+        std::memcpy(&index, buffer.data() + 12, sizeof(index));
+      } else {
+        // RTP header, 4 reserved bytes, then the NV_VIDEO_PACKET header
+        if (bytes < sizeof(RTP_PACKET) + 4 + sizeof(NV_VIDEO_PACKET)) {
+          continue;
+        }
+        auto *packet = (PNV_VIDEO_PACKET) (buffer.data() + sizeof(RTP_PACKET) + 4);
+        index = packet->frameIndex;
+      }
+
+      ++stats.packets;
+      stats.bytes += bytes;
+
+      if (frame_index != index) {
+        if (frame_index) {
+          ++stats.frames;
+          stats.frame_completion.record(std::chrono::duration<double, std::milli>(frame_end - frame_start).count());
+        }
+
+        frame_index = index;
+        frame_start = now;
+      }
+      frame_end = now;
+    }
+  }
+
+  /**
+   * @brief Write the results to a JSON file.
+   * @return 0 on success, 1 if the file couldn't be written.
+   */
+  int write_json(const std::string &path, const nlohmann::json &results) {
+    std::ofstream file {path, std::ios::trunc};
+    file << results.dump(2) << std::endl;
+    if (!file) {
+      std::cerr << "Couldn't write the results to "sv << path << std::endl;
+      return 1;
+    }
+
+    return 0;
+  }
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  options_t options;
+  if (auto status = parse_options(argc, argv, options)) {
+    print_help(argv[0]);
+    return status > 0 ? 0 : 1;
+  }
+
+  if (!options.micro.empty()) {
+    nlohmann::json results;
+    if (micro_bench::run(options.micro, results)) {
+      std::cerr << "Unknown component: "sv << options.micro << std::endl;
+      return 1;
+    }
+
+    return options.json.empty() ? 0 : write_json(options.json, results);
+  }
+
+  // Stream synthetic frames, encoded in software, and never stop for a missing control connection
+  config::video.capture = "synthetic";
+  config::video.synthetic_pattern = options.pattern;
+  config::video.encoder = "software";
+  config::video.hevc_mode = options.codec == 1 ? 2 : 0;
+  config::video.av1_mode = options.codec == 2 ? 2 : 0;
+  config::stream.fec_percentage = options.fec;
+  config::stream.adaptive_fec = false;
+  config::stream.ping_timeout = std::chrono::seconds {options.duration + 60};
+  config::audio.stream = false;
+  config::sunshine.port = options.port;
+
+  mail::man = std::make_shared<safe::mail_raw_t>();
+
+  auto log_deinit_guard = logging::init(config::sunshine.min_log_level, "sunshine_bench.log");
+  if (!log_deinit_guard) {
+    std::cerr << "Logging failed to initialize"sv << std::endl;
+    return 1;
+  }
+
+  task_pool.start(1);
+  auto task_pool_guard = util::fail_guard([]() {
+    task_pool.stop();
+    task_pool.join();
+  });
+
+  auto platf_deinit_guard = platf::init();
+  if (!platf_deinit_guard) {
+    std::cerr << "Platform failed to initialize"sv << std::endl;
+    return 1;
+  }
+
+  reed_solomon_init();
+  auto input_deinit_guard = input::init();
+
+  if (video::probe_encoders()) {
+    std::cerr << "The software encoder isn't available"sv << std::endl;
+    return 1;
+  }
+
+  rtsp_stream::launch_session_t launch_session {};
+  launch_session.id = 1;
+  auto key = crypto::rand(16);
+  launch_session.gcm_key.assign(std::begin(key), std::end(key));
+  auto iv = crypto::rand(16);
+  launch_session.iv.assign(std::begin(iv), std::end(iv));
+  launch_session.av_ping_payload = util::hex_vec(crypto::rand(8));
+
+  stream::config_t stream_config {};
+  stream_config.packetsize = 1392;
+  stream_config.minRequiredFecPackets = 2;
+  stream_config.mlFeatureFlags = ML_FF_SESSION_ID_V1;
+  stream_config.encryptionFlagsEnabled = options.encrypt ? SS_ENC_VIDEO : 0;
+
+  stream_config.audio.packetDuration = 5;
+  stream_config.audio.channels = 2;
+  stream_config.audio.mask = 0x3;
+
+  auto &monitor = stream_config.monitor;
+  monitor.width = options.width;
+  monitor.height = options.height;
+  monitor.framerate = options.fps;
+  monitor.bitrate = options.bitrate;
+  monitor.slicesPerFrame = 1;
+  monitor.numRefFrames = 1;
+  monitor.videoFormat = options.codec;
+
+  auto session = stream::session::alloc(stream_config, launch_session);
+  if (!session || stream::session::start(*session, "127.0.0.1"s)) {
+    std::cerr << "Failed to start the streaming session"sv << std::endl;
+    return 1;
+  }
+
+  asio::io_context io_context;
+  udp::socket sock {io_context, udp::endpoint {asio::ip::address_v4::loopback(), 0}};
+  sock.set_option(asio::socket_base::receive_buffer_size {8 * 1024 * 1024});
+
+  // Wake up the receiver once in a while, so it notices when to stop
+  timeval timeout {0, 100000};
+  setsockopt(sock.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  udp::endpoint video_port {asio::ip::address_v4::loopback(), net::map_port(stream::VIDEO_STREAM_PORT)};
+  udp::endpoint audio_port {asio::ip::address_v4::loopback(), net::map_port(stream::AUDIO_STREAM_PORT)};
+
+  std::atomic_bool stopping {false};
+  receiver_stats_t received;
+  std::thread receiver {[&]() {
+    receive(sock, video_port, audio_port, launch_session.av_ping_payload, options.encrypt, stopping, received);
+  }};
+
+  auto start_cpu = std::clock();
+  auto start_time = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::seconds {options.duration});
+  auto cpu_s = (double) (std::clock() - start_cpu) / CLOCKS_PER_SEC;
+  auto wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+  // Grab the pipeline statistics before the session is removed from the registry
+  auto pipeline = stats::to_json();
+
+  stopping = true;
+  receiver.join();
+
+  stream::session::stop(*session);
+  stream::session::join(*session);
+
+  auto completion = received.frame_completion.snapshot();
+
+  nlohmann::json results;
+  results["width"] = options.width;
+  results["height"] = options.height;
+  results["fps"] = options.fps;
+  results["bitrate_kbps"] = options.bitrate;
+  results["fec_percentage"] = options.fec;
+  results["encrypt"] = options.encrypt;
+  results["codec"] = options.codec;
+  results["pattern"] = options.pattern;
+  results["duration_s"] = wall_s;
+  results["cpu_s"] = cpu_s;
+  results["cpu_percent"] = cpu_s / wall_s * 100.0;
+  results["frames_received"] = received.frames;
+  results["received_fps"] = received.frames / wall_s;
+  results["received_kbps"] = received.bytes * 8 / wall_s / 1000.0;
+  results["packets_received"] = received.packets;
+  results["frame_completion_ms"] = {
+    {"p50", completion.percentile(50)},
+    {"p90", completion.percentile(90)},
+    {"p99", completion.percentile(99)},
+    {"max", completion.max},
+  };
+  if (!pipeline["sessions"].empty()) {
+    results["pipeline"] = pipeline["sessions"][0];
+  }
+
+  std::cout << "Streamed "sv << options.pattern << " at "sv << options.width << 'x' << options.height << '@' << options.fps << ", "sv << options.bitrate << " Kbps, "sv
+            << options.fec << "% FEC"sv << (options.encrypt ? ", encrypted"sv : ""sv) << " for "sv << wall_s << 's' << std::endl;
+  std::cout << "Received "sv << received.frames << " frames ("sv << results["received_fps"].get<double>() << " fps, "sv
+            << results["received_kbps"].get<double>() << " Kbps)"sv << std::endl;
+  std::cout << "CPU time "sv << cpu_s << "s ("sv << results["cpu_percent"].get<double>() << "% of one core)"sv << std::endl;
+  std::cout << "Frame completion p50/p90/p99/max: "sv << completion.percentile(50) << '/' << completion.percentile(90) << '/'
+            << completion.percentile(99) << '/' << completion.max << " ms"sv << std::endl;
+  if (results.contains("pipeline")) {
+    for (auto &[stage, latency] : results["pipeline"]["latency_ms"].items()) {
+      std::cout << stage << " p50/p90/p99/max: "sv << latency["p50"] << '/' << latency["p90"] << '/' << latency["p99"] << '/' << latency["max"] << " ms"sv << std::endl;
+    }
+  }
+
+  if (!options.json.empty() && write_json(options.json, results)) {
+    return 1;
+  }
+
+  // No frames means the pipeline is broken, which should fail a CI job
+  return received.frames ? 0 : 1;
+}
@@ -112,6 +112,10 @@ set(SUNSHINE_TARGET_FILES
         "${CMAKE_SOURCE_DIR}/src/round_robin.h"
         "${CMAKE_SOURCE_DIR}/src/stat_trackers.h"
         "${CMAKE_SOURCE_DIR}/src/stat_trackers.cpp"
+        "${CMAKE_SOURCE_DIR}/src/stats.h"
+        "${CMAKE_SOURCE_DIR}/src/stats.cpp"
+        "${CMAKE_SOURCE_DIR}/src/trace.h"
+        "${CMAKE_SOURCE_DIR}/src/trace.cpp"
         "${CMAKE_SOURCE_DIR}/src/rswrapper.h"
         "${CMAKE_SOURCE_DIR}/src/rswrapper.c"
         ${PLATFORM_TARGET_FILES})
@@ -78,6 +78,14 @@ if(BUILD_TESTS)
     add_subdirectory(tests)
 endif()
 
+# benchmarks
+if(BUILD_BENCHMARKS)
+    if(NOT UNIX OR APPLE)
+        message(FATAL_ERROR "BUILD_BENCHMARKS is only supported on Linux")
+    endif()
+    add_subdirectory(benchmarks)
+endif()
+
 # custom compile flags, must be after adding tests
 
 if (NOT BUILD_TESTS)
@@ -3,6 +3,10 @@
  * @brief Definitions for audio capture and encoding.
  */
 // standard includes
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
 #include <thread>
 
 // lib includes
@@ -20,7 +24,52 @@
 namespace audio {
   using namespace std::literals;
   using opus_t = util::safe_ptr<OpusMSEncoder, opus_multistream_encoder_destroy>;
-  using sample_queue_t = std::shared_ptr<safe::queue_t<std::vector<float>>>;
+
+  /**
+   * @brief A frame of captured PCM samples.
+   */
+  struct sample_frame_t {
+    std::vector<float> samples;
+    std::chrono::steady_clock::time_point captured_at;
+  };
+
+  // TPCircularBuffer is only built on macOS, and it carries bytes rather than frames that can be recycled
+  using sample_queue_t = std::shared_ptr<safe::spsc_queue_t<sample_frame_t>>;
+
+  /**
+   * @brief A session receiving the packets of a shared audio capture.
+   */
+  struct capture_group_member_t {
+    void *channel_data;
+    std::int64_t sequence;  ///< Counts the packets queued for this session
+  };
+
+  /**
+   * @brief Sessions with identical audio settings, which are all fed by a single capture and encoder.
+   * @details The capture thread of the first member owns the microphone and the encoder, and
+   * queues every packet once per member. When the owner leaves, the next member takes over.
+   */
+  struct capture_group_t {
+    config_t config;
+
+    std::mutex lock;
+    std::condition_variable owner_changed;
+    std::vector<capture_group_member_t> members;
+
+    bool failed = false;  ///< The owner couldn't capture, so the other members capture on their own
+  };
+
+  /**
+   * @brief What a session waiting on its capture group does next.
+   */
+  enum class capture_group_wait_e {
+    owner,  ///< The session owns the capture of its group
+    failed,  ///< The capture of the group failed, so the session captures on its own
+    shutdown,  ///< The session is shutting down
+  };
+
+  static std::mutex capture_groups_lock;
+  static std::vector<std::weak_ptr<capture_group_t>> capture_groups;
 
   static int start_audio_control(audio_ctx_t &ctx);
   static void stop_audio_control(audio_ctx_t &);
@@ -30,6 +79,13 @@ namespace audio {
 
   constexpr auto SAMPLE_RATE = 48000;
 
+  // Number of preallocated frames that circulate between the capture and encode threads
+  constexpr auto SAMPLE_FRAMES = 30;
+
+  // Number of preallocated Opus packet buffers per encoder
+  constexpr auto PACKET_BUFFERS = 32;
+  constexpr auto MAX_PACKET_SIZE = 1400;
+
   // NOTE: If you adjust the bitrates listed here, make sure to update the
   // corresponding bitrate adjustment logic in rtsp_stream::cmd_announce()
   opus_stream_config_t stream_configs[MAX_STREAM_CONFIG] {
@@ -83,7 +139,150 @@ namespace audio {
     },
   };
 
-  void encodeThread(sample_queue_t samples, config_t config, void *channel_data) {
+  /**
+   * @brief Check whether two sessions can be fed by the same capture and encoder.
+   * @param a The audio settings of one session.
+   * @param b The audio settings of the other session.
+   * @return `true` if the captured and encoded audio would be identical.
+   */
+  bool is_same_stream(const config_t &a, const config_t &b) {
+    if (a.packetDuration != b.packetDuration || a.channels != b.channels || a.flags != b.flags) {
+      return false;
+    }
+
+    if (!a.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+      return true;
+    }
+
+    auto &params_a = a.customStreamParams;
+    auto &params_b = b.customStreamParams;
+    return params_a.channelCount == params_b.channelCount &&
+           params_a.streams == params_b.streams &&
+           params_a.coupledStreams == params_b.coupledStreams &&
+           std::memcmp(params_a.mapping, params_b.mapping, sizeof(params_a.mapping)) == 0;
+  }
+
+  /**
+   * @brief Create a capture group with a session as its only member.
+   * @param config The audio settings of the session.
+   * @param channel_data The session, passed on to the audio broadcast thread.
+   * @return The capture group, which no other session can join.
+   */
+  std::shared_ptr<capture_group_t> make_capture_group(const config_t &config, void *channel_data) {
+    auto group = std::make_shared<capture_group_t>();
+    group->config = config;
+    group->members.emplace_back(capture_group_member_t {channel_data, 0});
+
+    return group;
+  }
+
+  /**
+   * @brief Join the capture group for the audio settings of a session, creating it if needed.
+   * @details Unless `config::audio.shared_capture` is set, every session gets a group of its own.
+   * @param config The audio settings of the session.
+   * @param channel_data The session, passed on to the audio broadcast thread.
+   * @return The capture group.
+   */
+  std::shared_ptr<capture_group_t> join_capture_group(const config_t &config, void *channel_data) {
+    std::lock_guard lg {capture_groups_lock};
+
+    std::erase_if(capture_groups, [](auto &group) {
+      return group.expired();
+    });
+
+    for (auto &group_wp : capture_groups) {
+      if (!config::audio.shared_capture) {
+        break;
+      }
+
+      auto group = group_wp.lock();
+      if (!group) {
+        continue;
+      }
+
+      std::lock_guard group_lg {group->lock};
+      if (group->members.empty() || group->failed || !is_same_stream(group->config, config)) {
+        continue;
+      }
+
+      BOOST_LOG(info) << "Sharing the audio capture with "sv << group->members.size() << " other session(s)"sv;
+      group->members.emplace_back(capture_group_member_t {channel_data, 0});
+
+      return group;
+    }
+
+    auto group = make_capture_group(config, channel_data);
+    capture_groups.emplace_back(group);
+
+    return group;
+  }
+
+  /**
+   * @brief Leave a capture group, handing the capture over to the next member if we owned it.
+   * @param group The capture group.
+   * @param channel_data The session leaving the group.
+   */
+  void leave_capture_group(capture_group_t &group, void *channel_data) {
+    std::lock_guard lg {group.lock};
+
+    auto it = std::find_if(std::begin(group.members), std::end(group.members), [channel_data](auto &member) {
+      return member.channel_data == channel_data;
+    });
+    if (it == std::end(group.members)) {
+      return;
+    }
+
+    if (it == std::begin(group.members)) {
+      group.owner_changed.notify_all();
+    }
+    group.members.erase(it);
+  }
+
+  /**
+   * @brief Let the other members of a capture group know that its owner couldn't capture.
+   * @param group The capture group.
+   */
+  void fail_capture_group(capture_group_t &group) {
+    std::lock_guard lg {group.lock};
+
+    group.failed = true;
+    group.owner_changed.notify_all();
+  }
+
+  /**
+   * @brief Wait until the session owns the capture of its capture group.
+   * @param group The capture group.
+   * @param channel_data The waiting session.
+   * @param shutdown_event The shutdown event of the waiting session.
+   * @return What the session does next.
+   */
+  capture_group_wait_e wait_for_capture_group(capture_group_t &group, void *channel_data, safe::mail_raw_t::event_t<bool> &shutdown_event) {
+    std::unique_lock ul {group.lock};
+
+    while (group.members.front().channel_data != channel_data) {
+      if (group.failed) {
+        return capture_group_wait_e::failed;
+      }
+
+      if (shutdown_event->peek()) {
+        return capture_group_wait_e::shutdown;
+      }
+
+      // The shutdown event can't wake us up, so check it periodically
+      group.owner_changed.wait_for(ul, 100ms);
+    }
+
+    return capture_group_wait_e::owner;
+  }
+
+  /**
+   * @brief Encode captured frames into Opus packets for the broadcast thread.
+   * @param samples The frames captured for this stream.
+   * @param free_frames Where consumed frames are handed back to the capture thread.
+   * @param config The stream configuration.
+   * @param group The sessions each packet is queued for.
+   */
+  void encodeThread(sample_queue_t samples, sample_queue_t free_frames, config_t config, std::shared_ptr<capture_group_t> group) {
     auto packets = mail::man->queue<packet_t>(mail::audio_packets);
     auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
     if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
@@ -110,11 +309,25 @@ namespace audio {
                     << stream.channelCount << " channels, "sv
                     << stream.bitrate / 1000 << " kbps (total), LOWDELAY"sv;
 
+    // Packet buffers come back from the broadcast thread once they have been sent
+    auto pool = std::make_shared<buffer_pool_t::element_type>(PACKET_BUFFERS);
+    auto fg = util::fail_guard([&pool]() {
+      pool->stop();
+    });
+
+    logging::percentile_periodic_logger<double> capture_delay_logger(debug, "Audio capture to encode delay", "ms");
+
+    buffer_t encoded {MAX_PACKET_SIZE};
+
     auto frame_size = config.packetDuration * stream.sampleRate / 1000;
-    while (auto sample = samples->pop()) {
-      buffer_t packet {1400};
+    while (auto frame = samples->pop()) {
+      capture_delay_logger.collect_and_log(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame->captured_at).count());
+
+      int bytes = opus_multistream_encode_float(opus.get(), frame->samples.data(), frame_size, std::begin(encoded), encoded.size());
+
+      // The samples have been consumed, so the capture thread may fill the frame again
+      free_frames->raise(std::move(*frame));
 
-      int bytes = opus_multistream_encode_float(opus.get(), sample->data(), frame_size, std::begin(packet), packet.size());
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio: "sv << opus_strerror(bytes);
         packets->stop();
@@ -122,8 +335,21 @@ namespace audio {
         return;
       }
 
-      packet.fake_resize(bytes);
-      packets->raise(channel_data, std::move(packet));
+      // Every session gets its own copy, since the broadcast thread encrypts them separately
+      std::lock_guard lg {group->lock};
+      for (auto &member : group->members) {
+        buffer_t packet;
+        if (pool->peek()) {
+          packet = std::move(*pool->pop());
+        } else {
+          packet = buffer_t {MAX_PACKET_SIZE};
+        }
+
+        std::copy_n(std::begin(encoded), bytes, std::begin(packet));
+        packet.fake_resize(bytes);
+
+        packets->raise(packet_t {member.channel_data, std::move(packet), member.sequence++, std::chrono::steady_clock::now(), pool});
+      }
     }
   }
 
@@ -133,19 +359,42 @@ namespace audio {
       shutdown_event->view();
       return;
     }
-    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
-    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
-      apply_surround_params(stream, config.customStreamParams);
-    }
 
+    // Every member holds the audio context, so the sink survives the owner handing the capture over
     auto ref = get_audio_ctx_ref();
     if (!ref) {
       return;
     }
 
-    auto init_failure_fg = util::fail_guard([&shutdown_event]() {
+    // With shared capture, sessions with identical audio settings share the capture of the first one
+    auto group = join_capture_group(config, channel_data);
+    auto leave_group = util::fail_guard([&]() {
+      leave_capture_group(*group, channel_data);
+    });
+    switch (wait_for_capture_group(*group, channel_data, shutdown_event)) {
+      case capture_group_wait_e::owner:
+        break;
+      case capture_group_wait_e::failed:
+        // Rather than going without audio, try a capture of our own
+        BOOST_LOG(warning) << "Shared audio capture failed, capturing for this session alone"sv;
+        leave_capture_group(*group, channel_data);
+        group = make_capture_group(config, channel_data);
+        break;
+      case capture_group_wait_e::shutdown:
+        return;
+    }
+
+    auto stream = stream_configs[map_stream(config.channels, config.flags[config_t::HIGH_QUALITY])];
+    if (config.flags[config_t::CUSTOM_SURROUND_PARAMS]) {
+      apply_surround_params(stream, config.customStreamParams);
+    }
+
+    auto init_failure_fg = util::fail_guard([&shutdown_event, &group]() {
       BOOST_LOG(error) << "Unable to initialize audio capture. The stream will not have audio."sv;
 
+      // The other members would otherwise wait for this capture until this session ends
+      fail_capture_group(*group);
+
       // Wait for shutdown to be signalled if we fail init.
       // This allows streaming to continue without audio.
       shutdown_event->view();
@@ -205,23 +454,42 @@ namespace audio {
     // Capture takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::critical);
 
-    auto samples = std::make_shared<sample_queue_t::element_type>(30);
-    std::thread thread {encodeThread, samples, config, channel_data};
+    int samples_per_frame = frame_size * stream.channelCount;
+
+    // Frames circulate between this thread and the encoder, so capturing doesn't allocate
+    auto samples = std::make_shared<sample_queue_t::element_type>(SAMPLE_FRAMES);
+    auto free_frames = std::make_shared<sample_queue_t::element_type>(SAMPLE_FRAMES);
+    for (int x = 0; x < SAMPLE_FRAMES; ++x) {
+      free_frames->raise(sample_frame_t {std::vector<float>(samples_per_frame)});
+    }
+
+    // Captured into when the encoder holds every frame, then dropped
+    sample_frame_t overflow_frame {std::vector<float>(samples_per_frame)};
+    sample_frame_t frame;
+
+    std::thread thread {encodeThread, samples, free_frames, config, group};
 
     auto fg = util::fail_guard([&]() {
       samples->stop();
+      free_frames->stop();
       thread.join();
 
+      // Capture failed while the session is still running, so the other members take over
+      if (!shutdown_event->peek()) {
+        fail_capture_group(*group);
+      }
+
       shutdown_event->view();
     });
 
-    int samples_per_frame = frame_size * stream.channelCount;
-
     while (!shutdown_event->peek()) {
-      std::vector<float> sample_buffer;
-      sample_buffer.resize(samples_per_frame);
+      if (frame.samples.empty() && free_frames->peek()) {
+        frame = std::move(*free_frames->pop());
+      }
+
+      auto &target = frame.samples.empty() ? overflow_frame : frame;
 
-      auto status = mic->sample(sample_buffer);
+      auto status = mic->sample(target.samples);
       switch (status) {
         case platf::capture_e::ok:
           break;
@@ -241,7 +509,14 @@ namespace audio {
           return;
       }
 
-      samples->raise(std::move(sample_buffer));
+      if (&target == &overflow_frame) {
+        BOOST_LOG(verbose) << "Audio encoder is falling behind, dropping captured frame"sv;
+        continue;
+      }
+
+      frame.captured_at = std::chrono::steady_clock::now();
+      samples->raise(std::move(frame));
+      frame = sample_frame_t {};
     }
   }
 
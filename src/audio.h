@@ -69,7 +69,32 @@ namespace audio {
   };
 
   using buffer_t = util::buffer_t<std::uint8_t>;
-  using packet_t = std::pair<void *, buffer_t>;
+
+  /**
+   * @brief Takes encoded packet buffers back to the encoder that produced them, so they can be reused.
+   */
+  using buffer_pool_t = std::shared_ptr<safe::spsc_queue_t<buffer_t>>;
+
+  /**
+   * @brief An encoded audio packet on its way to the broadcast thread.
+   */
+  struct packet_t {
+    void *channel_data;
+    buffer_t data;
+    std::int64_t sequence;  ///< Per-stream packet counter, gaps mean the packet queue overflowed
+    std::chrono::steady_clock::time_point queued_at;
+    buffer_pool_t pool;  ///< Where to return `data` once it has been consumed, may be empty
+
+    /**
+     * @brief Hand the packet buffer back to the encoder once its contents are no longer needed.
+     */
+    void recycle() {
+      if (pool) {
+        pool->raise(std::move(data));
+      }
+    }
+  };
+
   using audio_ctx_ref_t = safe::shared_t<audio_ctx_t>::ptr_t;
 
   void capture(safe::mail_t mail, config_t config, void *channel_data);
@@ -441,6 +441,7 @@ namespace config {
     0,  // av1_mode
 
     2,  // min_threads
+    false,  // shared_encode
     {
       "superfast"s,  // preset
       "zerolatency"s,  // tune
@@ -487,6 +488,7 @@ namespace config {
     },  // vaapi
 
     {},  // capture
+    "desktop"s,  // synthetic_pattern
     {},  // encoder
     {},  // adapter_name
     {},  // output_name
@@ -512,6 +514,7 @@ namespace config {
     {},  // audio_sink
     {},  // virtual_sink
     true,  // stream audio
+    false,  // shared_capture
     true,  // install_steam_drivers
   };
 
@@ -521,6 +524,12 @@ namespace config {
     APPS_JSON_PATH,
 
     20,  // fecPercentage
+    false,  // adaptive_fec
+    0,  // packetize_threads
+    0,  // pacing_link_rate
+    0,  // pacing_spin_us
+    false,  // pacing_realtime
+    false,  // kernel_pacing
 
     ENCRYPTION_MODE_NEVER,  // lan_encryption_mode
     ENCRYPTION_MODE_OPPORTUNISTIC,  // wan_encryption_mode
@@ -579,6 +588,7 @@ namespace config {
     platf::appdata().string() + "/sunshine.log",  // log file
     false,  // notify_pre_releases
     true,  // system_tray
+    false,  // frame_tracing
     {},  // prep commands
   };
 
@@ -1062,6 +1072,7 @@ namespace config {
     int_between_f(vars, "hevc_mode", video.hevc_mode, {0, 3});
     int_between_f(vars, "av1_mode", video.av1_mode, {0, 3});
     int_f(vars, "min_threads", video.min_threads);
+    bool_f(vars, "shared_encode", video.shared_encode);
     string_f(vars, "sw_preset", video.sw.sw_preset);
     if (!video.sw.sw_preset.empty()) {
       video.sw.svtav1_preset = sw::svtav1_preset_from_view(video.sw.sw_preset);
@@ -1128,6 +1139,7 @@ namespace config {
     bool_f(vars, "vaapi_strict_rc_buffer", video.vaapi.strict_rc_buffer);
 
     string_f(vars, "capture", video.capture);
+    string_restricted_f(vars, "synthetic_pattern", video.synthetic_pattern, {"desktop"sv, "text"sv, "noise"sv, "damage"sv});
     string_f(vars, "encoder", video.encoder);
     string_f(vars, "adapter_name", video.adapter_name);
     string_f(vars, "output_name", video.output_name);
@@ -1172,6 +1184,7 @@ namespace config {
     string_f(vars, "audio_sink", audio.sink);
     string_f(vars, "virtual_sink", audio.virtual_sink);
     bool_f(vars, "stream_audio", audio.stream);
+    bool_f(vars, "shared_audio_capture", audio.shared_capture);
     bool_f(vars, "install_steam_audio_drivers", audio.install_steam_drivers);
 
     string_restricted_f(vars, "origin_web_ui_allowed", nvhttp.origin_web_ui_allowed, {"pc"sv, "lan"sv, "wan"sv});
@@ -1187,6 +1200,12 @@ namespace config {
 
     path_f(vars, "file_apps", stream.file_apps);
     int_between_f(vars, "fec_percentage", stream.fec_percentage, {1, 255});
+    bool_f(vars, "adaptive_fec", stream.adaptive_fec);
+    int_between_f(vars, "packetize_threads", stream.packetize_threads, {0, 16});
+    int_between_f(vars, "pacing_link_rate", stream.pacing_link_rate, {0, 100000});
+    int_between_f(vars, "pacing_spin_us", stream.pacing_spin_us, {0, 1000});
+    bool_f(vars, "pacing_realtime", stream.pacing_realtime);
+    bool_f(vars, "kernel_pacing", stream.kernel_pacing);
 
     map_int_int_f(vars, "keybindings"s, input.keybindings);
 
@@ -1236,6 +1255,7 @@ namespace config {
 
     bool_f(vars, "notify_pre_releases", sunshine.notify_pre_releases);
     bool_f(vars, "system_tray", sunshine.system_tray);
+    bool_f(vars, "frame_tracing", sunshine.frame_tracing);
 
     int port = sunshine.port;
     int_between_f(vars, "port"s, port, {1024 + nvhttp::PORT_HTTPS, 65535 - rtsp_stream::RTSP_SETUP_PORT});
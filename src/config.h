@@ -27,6 +27,7 @@ namespace config {
     int av1_mode;
 
     int min_threads;  // Minimum number of threads/slices for CPU encoding
+    bool shared_encode;  // Encode once for all sessions with identical stream settings
 
     struct {
       std::string sw_preset;
@@ -81,6 +82,7 @@ namespace config {
     } vaapi;
 
     std::string capture;
+    std::string synthetic_pattern;
     std::string encoder;
     std::string adapter_name;
     std::string output_name;
@@ -148,6 +150,7 @@ namespace config {
     std::string sink;
     std::string virtual_sink;
     bool stream;
+    bool shared_capture;  // Capture and encode once for all sessions with identical audio settings
     bool install_steam_drivers;
   };
 
@@ -162,6 +165,22 @@ namespace config {
 
     int fec_percentage;
 
+    // Adapt the FEC percentage to the loss reported by each client, up to fec_percentage
+    bool adaptive_fec;
+
+    // Number of worker threads preparing video packets, 0 prepares them on the broadcast thread
+    int packetize_threads;
+
+    // Link rate in Mbps used as the upper bound of video packet pacing, 0 means 1 Gbps
+    int pacing_link_rate;
+
+    // Busy-wait at the end of pacing sleeps and optionally pace from a SCHED_FIFO thread (Linux only)
+    int pacing_spin_us;
+    bool pacing_realtime;
+
+    // Let the kernel pace video packets using SO_TXTIME (Linux only)
+    bool kernel_pacing;
+
     // Video encryption settings for LAN and WAN streams
     int lan_encryption_mode;
     int wan_encryption_mode;
@@ -257,6 +276,7 @@ namespace config {
     std::string log_file;
     bool notify_pre_releases;
     bool system_tray;
+    bool frame_tracing;
     std::vector<prep_cmd_t> prep_cmds;
   };
 
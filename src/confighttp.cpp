@@ -33,6 +33,8 @@
 #include "nvhttp.h"
 #include "platform/common.h"
 #include "process.h"
+#include "stats.h"
+#include "trace.h"
 #include "utility.h"
 #include "uuid.h"
 
@@ -1150,6 +1152,76 @@ namespace confighttp {
     send_response(response, output_tree);
   }
 
+  /**
+   * @brief Get the live statistics of the streaming sessions.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * Per session, this reports the frame rate, bitrate, FEC percentage, sent and dropped
+   * frames and packets, queue depths, and the percentiles of the latency of each stage.
+   * Latencies cover the last completed window of at least 20 seconds, whose length is reported
+   * as `latency_window_s`; until the first window completes, they cover the whole session.
+   * The raw histogram buckets of each latency are included too, as `[upper bound, count]` pairs.
+   *
+   * @api_examples{/api/stats| GET| null}
+   */
+  void getStats(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    send_response(response, stats::to_json());
+  }
+
+  /**
+   * @brief Get the live statistics of the streaming sessions for Prometheus.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The statistics are the same as the ones of `/api/stats`, in the Prometheus text exposition format.
+   * Latencies are exported as histograms, cumulative since the session started, so percentiles
+   * over any window can be computed with `histogram_quantile()`.
+   *
+   * @api_examples{/metrics| GET| null}
+   */
+  void getMetrics(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "text/plain; version=0.0.4");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, stats::to_prometheus(), headers);
+  }
+
+  /**
+   * @brief Get the recorded per-frame trace.
+   * @param response The HTTP response object.
+   * @param request The HTTP request object.
+   * The trace is in the Chrome trace event format, which can be loaded in Perfetto or chrome://tracing.
+   * It is empty unless `frame_tracing` is enabled.
+   *
+   * @api_examples{/api/trace| GET| null}
+   */
+  void getTrace(resp_https_t response, req_https_t request) {
+    if (!authenticate(response, request)) {
+      return;
+    }
+
+    print_req(request);
+
+    SimpleWeb::CaseInsensitiveMultimap headers;
+    headers.emplace("Content-Type", "application/json");
+    headers.emplace("Content-Disposition", "attachment; filename=\"sunshine_trace.json\"");
+    headers.emplace("X-Frame-Options", "DENY");
+    headers.emplace("Content-Security-Policy", "frame-ancestors 'none';");
+    response->write(SimpleWeb::StatusCode::success_ok, trace::to_chrome_json(), headers);
+  }
+
   /**
    * @brief Restart Sunshine.
    * @param response The HTTP response object.
@@ -1202,6 +1274,9 @@ namespace confighttp {
     server.resource["^/api/pin$"]["POST"] = savePin;
     server.resource["^/api/apps$"]["GET"] = getApps;
     server.resource["^/api/logs$"]["GET"] = getLogs;
+    server.resource["^/api/stats$"]["GET"] = getStats;
+    server.resource["^/metrics$"]["GET"] = getMetrics;
+    server.resource["^/api/trace$"]["GET"] = getTrace;
     server.resource["^/api/apps$"]["POST"] = saveApp;
     server.resource["^/api/config$"]["GET"] = getConfig;
     server.resource["^/api/config$"]["POST"] = saveConfig;
@@ -88,20 +88,20 @@ namespace logging {
   /**
    * @brief A helper class for tracking and logging numerical values across a period of time
    * @examples
-   * min_max_avg_periodic_logger<int> logger(debug, "Test time value", "ms", 5s);
+   * percentile_periodic_logger<double> logger(debug, "Test time value", "ms", 5s);
    * logger.collect_and_log(1);
    * // ...
    * logger.collect_and_log(2);
    * // after 5 seconds
    * logger.collect_and_log(3);
    * // In the log:
-   * // [2024:01:01:12:00:00]: Debug: Test time value (min/max/avg): 1ms/3ms/2.00ms
+   * // [2024:01:01:12:00:00]: Debug: Test time value (p50/p90/p99/max): 1.00ms/2.00ms/2.00ms/2.00ms
    * @examples_end
    */
   template<typename T>
-  class min_max_avg_periodic_logger {
+  class percentile_periodic_logger {
   public:
-    min_max_avg_periodic_logger(boost::log::sources::severity_logger<int> &severity, std::string_view message, std::string_view units, std::chrono::seconds interval_in_seconds = std::chrono::seconds(20)):
+    percentile_periodic_logger(boost::log::sources::severity_logger<int> &severity, std::string_view message, std::string_view units, std::chrono::seconds interval_in_seconds = std::chrono::seconds(20)):
         severity(severity),
         message(message),
         units(units),
@@ -110,21 +110,25 @@ namespace logging {
     }
 
     void collect_and_log(const T &value) {
+      if (histogram) {
+        histogram->record((double) value);
+      }
+
       if (enabled) {
-        auto print_info = [&](const T &min_value, const T &max_value, double avg_value) {
+        auto print_info = [&](const stat_trackers::histogram_t::snapshot_t &snapshot) {
           auto f = stat_trackers::two_digits_after_decimal();
-          if constexpr (std::is_floating_point_v<T>) {
-            BOOST_LOG(severity.get()) << message << " (min/max/avg): " << f % min_value << units << "/" << f % max_value << units << "/" << f % avg_value << units;
-          } else {
-            BOOST_LOG(severity.get()) << message << " (min/max/avg): " << min_value << units << "/" << max_value << units << "/" << f % avg_value << units;
-          }
+          BOOST_LOG(severity.get()) << message << " (p50/p90/p99/max): "
+                                    << f % snapshot.percentile(50) << units << "/"
+                                    << f % snapshot.percentile(90) << units << "/"
+                                    << f % snapshot.percentile(99) << units << "/"
+                                    << f % snapshot.max << units;
         };
-        tracker.collect_and_callback_on_interval(value, print_info, interval);
+        tracker.collect_and_callback_on_interval((double) value, print_info, interval);
       }
     }
 
     void collect_and_log(std::function<T()> func) {
-      if (enabled) {
+      if (is_enabled()) {
         collect_and_log(func());
       }
     }
@@ -135,8 +139,16 @@ namespace logging {
       }
     }
 
+    /**
+     * @brief Also record every collected value into a histogram, even if the log level hides the log lines.
+     * @param histogram The histogram, or nullptr to stop recording.
+     */
+    void record_into(stat_trackers::histogram_t *histogram) {
+      this->histogram = histogram;
+    }
+
     bool is_enabled() const {
-      return enabled;
+      return enabled || histogram;
     }
 
   private:
@@ -145,7 +157,8 @@ namespace logging {
     std::string units;
     std::chrono::seconds interval;
     bool enabled;
-    stat_trackers::min_max_avg_tracker<T> tracker;
+    stat_trackers::percentile_tracker tracker;
+    stat_trackers::histogram_t *histogram = nullptr;
   };
 
   /**
@@ -160,7 +173,7 @@ namespace logging {
    * // ...
    * logger.second_point_now_and_log();
    * // In the log:
-   * // [2024:01:01:12:00:00]: Debug: Test duration (min/max/avg): 1.23ms/3.21ms/2.31ms
+   * // [2024:01:01:12:00:00]: Debug: Test duration (p50/p90/p99/max): 2.31ms/3.02ms/3.21ms/3.21ms
    * @examples_end
    */
   class time_delta_periodic_logger {
@@ -199,13 +212,21 @@ namespace logging {
       }
     }
 
+    /**
+     * @brief Also record every measured interval into a histogram, even if the log level hides the log lines.
+     * @param histogram The histogram, or nullptr to stop recording.
+     */
+    void record_into(stat_trackers::histogram_t *histogram) {
+      logger.record_into(histogram);
+    }
+
     bool is_enabled() const {
       return logger.is_enabled();
     }
 
   private:
     std::chrono::steady_clock::time_point point1 = std::chrono::steady_clock::now();
-    min_max_avg_periodic_logger<double> logger;
+    percentile_periodic_logger<double> logger;
   };
 
   /**
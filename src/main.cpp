@@ -19,6 +19,7 @@
 #include "nvhttp.h"
 #include "process.h"
 #include "system_tray.h"
+#include "trace.h"
 #include "upnp.h"
 #include "video.h"
 
@@ -188,6 +189,8 @@ int main(int argc, char *argv[]) {
     return fn->second(argv[0], config::sunshine.cmd.argc, config::sunshine.cmd.argv);
   }
 
+  trace::enable(config::sunshine.frame_tracing);
+
   // Adding guard here first as it also performs recovery after crash,
   // otherwise people could theoretically end up without display output.
   // It also should be destroyed before forced shutdown to expedite the cleanup.
@@ -410,6 +413,10 @@ int main(int argc, char *argv[]) {
   task_pool.stop();
   task_pool.join();
 
+  if (trace::enabled()) {
+    trace::dump(platf::appdata() / "sunshine_trace.json");
+  }
+
 #ifdef _WIN32
   // Restore global NVIDIA control panel settings
   if (nvprefs_instance.owning_undo_file() && nvprefs_instance.load()) {
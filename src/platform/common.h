@@ -6,9 +6,11 @@
 
 // standard includes
 #include <bitset>
+#include <chrono>
 #include <filesystem>
 #include <functional>
 #include <mutex>
+#include <span>
 #include <string>
 
 // lib includes
@@ -670,6 +672,10 @@ namespace platf {
     uint16_t target_port;
     boost::asio::ip::address &source_address;
 
+    // Optional time at which the kernel should transmit the batch.
+    // Only honored on sockets where enable_kernel_pacing() succeeded.
+    std::chrono::steady_clock::time_point txtime {};
+
     /**
      * @brief Returns a payload buffer descriptor for the given payload offset.
      * @param offset The offset in the total payload data (bytes).
@@ -702,10 +708,43 @@ namespace platf {
     boost::asio::ip::address &target_address;
     uint16_t target_port;
     boost::asio::ip::address &source_address;
+
+    // Optional time at which the kernel should transmit the datagram.
+    // Only honored on sockets where enable_kernel_pacing() succeeded.
+    std::chrono::steady_clock::time_point txtime {};
   };
 
   bool send(send_info_t &send_info);
 
+  /**
+   * @brief Send several independent datagrams with as few calls as the platform allows.
+   * @param send_infos The datagrams to send. They must share a socket, but may differ in peer and header size.
+   * @return `true` if all datagrams were sent.
+   */
+  bool send_many(std::span<send_info_t> send_infos);
+
+  struct recv_datagram_t {
+    // Buffer for the payload of the datagram
+    char *buffer;
+    size_t buffer_size;
+
+    // Buffer for the socket address of the sender
+    sockaddr *peer;
+    size_t peer_size;
+
+    // The number of bytes received into each buffer
+    size_t bytes;
+    size_t peer_bytes;
+  };
+
+  /**
+   * @brief Receive the datagrams waiting on a socket with a single call, without blocking.
+   * @param native_socket The native socket handle.
+   * @param datagrams The buffers to receive into, one datagram each.
+   * @return The number of datagrams received, or -1 if batched receive isn't supported.
+   */
+  int recv_batch(uintptr_t native_socket, std::span<recv_datagram_t> datagrams);
+
   enum class qos_data_type_e : int {
     audio,  ///< Audio
     video  ///< Video
@@ -721,6 +760,20 @@ namespace platf {
    */
   std::unique_ptr<deinit_t> enable_socket_qos(uintptr_t native_socket, boost::asio::ip::address &address, uint16_t port, qos_data_type_e data_type, bool dscp_tagging);
 
+  /**
+   * @brief Let the kernel pace batches sent on the given socket according to their transmit time.
+   * @param native_socket The native socket handle.
+   * @return `true` if `batched_send_info_t::txtime` will be honored for this socket.
+   */
+  bool enable_kernel_pacing(uintptr_t native_socket);
+
+  /**
+   * @brief Run the calling thread with real-time scheduling.
+   * @return An object restoring the previous scheduling policy of the thread when destroyed,
+   * or `nullptr` if real-time scheduling is unavailable.
+   */
+  std::unique_ptr<deinit_t> enable_realtime_scheduling();
+
   /**
    * @brief Open a url in the default web browser.
    * @param url The url to open.
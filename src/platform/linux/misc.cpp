@@ -16,8 +16,13 @@
 #include <arpa/inet.h>
 #include <dlfcn.h>
 #include <ifaddrs.h>
+#include <linux/net_tstamp.h>
 #include <netinet/udp.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <time.h>
 
 // lib includes
 #include <boost/asio/ip/address.hpp>
@@ -377,7 +382,7 @@ namespace platf {
     }
 
     union {
-      char buf[CMSG_SPACE(sizeof(uint16_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+      char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
       struct cmsghdr alignment;
     } cmbuf = {};  // Must be zeroed for CMSG_NXTHDR()
 
@@ -386,8 +391,9 @@ namespace platf {
     msg.msg_control = cmbuf.buf;
     msg.msg_controllen = sizeof(cmbuf.buf);
 
-    // The PKTINFO option will always be first, then we will conditionally
-    // append the UDP_SEGMENT option next if applicable.
+    // The PKTINFO option will always be first, followed by the TXTIME option if the
+    // batch has a transmit time, then we will conditionally append the UDP_SEGMENT
+    // option next if applicable.
     auto pktinfo_cm = CMSG_FIRSTHDR(&msg);
     if (send_info.source_address.is_v6()) {
       struct in6_pktinfo pktInfo;
@@ -417,6 +423,24 @@ namespace platf {
       memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
     }
 
+    auto last_cm = pktinfo_cm;
+#ifdef SCM_TXTIME
+    if (send_info.txtime.time_since_epoch().count() != 0) {
+      // The socket uses CLOCK_MONOTONIC, which is what std::chrono::steady_clock is based on
+      uint64_t txtime = std::chrono::duration_cast<std::chrono::nanoseconds>(send_info.txtime.time_since_epoch()).count();
+
+      cmbuflen += CMSG_SPACE(sizeof(txtime));
+
+      auto txtime_cm = CMSG_NXTHDR(&msg, pktinfo_cm);
+      txtime_cm->cmsg_level = SOL_SOCKET;
+      txtime_cm->cmsg_type = SCM_TXTIME;
+      txtime_cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+      memcpy(CMSG_DATA(txtime_cm), &txtime, sizeof(txtime));
+
+      last_cm = txtime_cm;
+    }
+#endif
+
     auto const max_iovs_per_msg = send_info.payload_buffers.size() + (send_info.headers ? 1 : 0);
 
 #ifdef UDP_SEGMENT
@@ -461,7 +485,7 @@ namespace platf {
           msg.msg_controllen = cmbuflen + CMSG_SPACE(sizeof(uint16_t));
 
           // Enable GSO to perform segmentation of our buffer for us
-          auto cm = CMSG_NXTHDR(&msg, pktinfo_cm);
+          auto cm = CMSG_NXTHDR(&msg, last_cm);
           cm->cmsg_level = SOL_UDP;
           cm->cmsg_type = UDP_SEGMENT;
           cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
@@ -564,34 +588,83 @@ namespace platf {
     }
   }
 
-  bool send(send_info_t &send_info) {
-    auto sockfd = (int) send_info.native_socket;
-    struct msghdr msg = {};
+  int recv_batch(uintptr_t native_socket, std::span<recv_datagram_t> datagrams) {
+    constexpr auto max_datagrams = 64;
+
+    struct mmsghdr msgs[max_datagrams];
+    struct iovec iovs[max_datagrams];
+
+    auto count = std::min<std::size_t>(datagrams.size(), max_datagrams);
+    for (std::size_t x = 0; x < count; ++x) {
+      iovs[x].iov_base = datagrams[x].buffer;
+      iovs[x].iov_len = datagrams[x].buffer_size;
+
+      msgs[x] = {};
+      msgs[x].msg_hdr.msg_name = datagrams[x].peer;
+      msgs[x].msg_hdr.msg_namelen = datagrams[x].peer_size;
+      msgs[x].msg_hdr.msg_iov = &iovs[x];
+      msgs[x].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto received = recvmmsg((int) native_socket, msgs, count, MSG_DONTWAIT, nullptr);
+    if (received < 0) {
+      // ICMP errors for earlier sends are reported here too, they're not fatal
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED && errno != ECONNRESET) {
+        BOOST_LOG(error) << "recvmmsg() failed: "sv << errno;
+      }
+
+      return 0;
+    }
+
+    for (int x = 0; x < received; ++x) {
+      datagrams[x].bytes = msgs[x].msg_len;
+      datagrams[x].peer_bytes = msgs[x].msg_hdr.msg_namelen;
+    }
+
+    return received;
+  }
+
+  /**
+   * @brief Storage for the parts of a message header that describe a single send_info_t.
+   */
+  struct send_msg_storage_t {
+    struct sockaddr_in taddr_v4;
+    struct sockaddr_in6 taddr_v6;
+
+    struct iovec iovs[2];
+
+    struct {
+      alignas(struct cmsghdr) char buf[CMSG_SPACE(sizeof(uint64_t)) + std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
+    } cmbuf;
+  };
+
+  /**
+   * @brief Fill in a message header for sending a single datagram.
+   * @param send_info The datagram to send.
+   * @param storage Storage for the message header, which must outlive the send call.
+   * @param msg The message header to fill in.
+   */
+  static void fill_send_msg(send_info_t &send_info, send_msg_storage_t &storage, struct msghdr &msg) {
+    msg = {};
+    storage = {};
 
     // Convert the target address into a sockaddr
-    struct sockaddr_in taddr_v4 = {};
-    struct sockaddr_in6 taddr_v6 = {};
     if (send_info.target_address.is_v6()) {
-      taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
+      storage.taddr_v6 = to_sockaddr(send_info.target_address.to_v6(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v6;
-      msg.msg_namelen = sizeof(taddr_v6);
+      msg.msg_name = (struct sockaddr *) &storage.taddr_v6;
+      msg.msg_namelen = sizeof(storage.taddr_v6);
     } else {
-      taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
+      storage.taddr_v4 = to_sockaddr(send_info.target_address.to_v4(), send_info.target_port);
 
-      msg.msg_name = (struct sockaddr *) &taddr_v4;
-      msg.msg_namelen = sizeof(taddr_v4);
+      msg.msg_name = (struct sockaddr *) &storage.taddr_v4;
+      msg.msg_namelen = sizeof(storage.taddr_v4);
     }
 
-    union {
-      char buf[std::max(CMSG_SPACE(sizeof(struct in_pktinfo)), CMSG_SPACE(sizeof(struct in6_pktinfo)))];
-      struct cmsghdr alignment;
-    } cmbuf;
-
     socklen_t cmbuflen = 0;
 
-    msg.msg_control = cmbuf.buf;
-    msg.msg_controllen = sizeof(cmbuf.buf);
+    msg.msg_control = storage.cmbuf.buf;
+    msg.msg_controllen = sizeof(storage.cmbuf.buf);
 
     auto pktinfo_cm = CMSG_FIRSTHDR(&msg);
     if (send_info.source_address.is_v6()) {
@@ -622,21 +695,99 @@ namespace platf {
       memcpy(CMSG_DATA(pktinfo_cm), &pktInfo, sizeof(pktInfo));
     }
 
-    struct iovec iovs[2];
+#ifdef SCM_TXTIME
+    if (send_info.txtime.time_since_epoch().count() != 0) {
+      // The socket uses CLOCK_MONOTONIC, which is what std::chrono::steady_clock is based on
+      uint64_t txtime = std::chrono::duration_cast<std::chrono::nanoseconds>(send_info.txtime.time_since_epoch()).count();
+
+      cmbuflen += CMSG_SPACE(sizeof(txtime));
+
+      auto txtime_cm = CMSG_NXTHDR(&msg, pktinfo_cm);
+      txtime_cm->cmsg_level = SOL_SOCKET;
+      txtime_cm->cmsg_type = SCM_TXTIME;
+      txtime_cm->cmsg_len = CMSG_LEN(sizeof(txtime));
+      memcpy(CMSG_DATA(txtime_cm), &txtime, sizeof(txtime));
+    }
+#endif
+
     int iovlen = 0;
     if (send_info.header) {
-      iovs[iovlen].iov_base = (void *) send_info.header;
-      iovs[iovlen].iov_len = send_info.header_size;
+      storage.iovs[iovlen].iov_base = (void *) send_info.header;
+      storage.iovs[iovlen].iov_len = send_info.header_size;
       iovlen++;
     }
-    iovs[iovlen].iov_base = (void *) send_info.payload;
-    iovs[iovlen].iov_len = send_info.payload_size;
+    storage.iovs[iovlen].iov_base = (void *) send_info.payload;
+    storage.iovs[iovlen].iov_len = send_info.payload_size;
     iovlen++;
 
-    msg.msg_iov = iovs;
+    msg.msg_iov = storage.iovs;
     msg.msg_iovlen = iovlen;
 
     msg.msg_controllen = cmbuflen;
+  }
+
+  bool send_many(std::span<send_info_t> send_infos) {
+    if (send_infos.empty()) {
+      return true;
+    }
+
+    auto sockfd = (int) send_infos.front().native_socket;
+
+    constexpr std::size_t max_msgs = 64;
+    send_msg_storage_t storage[max_msgs];
+    struct mmsghdr msgs[max_msgs];
+
+    bool sent_all = true;
+
+    for (std::size_t offset = 0; offset < send_infos.size(); offset += max_msgs) {
+      auto count = std::min(max_msgs, send_infos.size() - offset);
+      for (std::size_t x = 0; x < count; ++x) {
+        msgs[x].msg_len = 0;
+        fill_send_msg(send_infos[offset + x], storage[x], msgs[x].msg_hdr);
+      }
+
+      // Call sendmmsg() until all messages are sent
+      std::size_t msgs_sent = 0;
+      while (msgs_sent < count) {
+        int sent = sendmmsg(sockfd, &msgs[msgs_sent], count - msgs_sent, 0);
+        if (sent < 0) {
+          // If there's no send buffer space, wait for some to be available
+          if (errno == EAGAIN) {
+            struct pollfd pfd;
+
+            pfd.fd = sockfd;
+            pfd.events = POLLOUT;
+
+            if (poll(&pfd, 1, -1) != 1) {
+              BOOST_LOG(warning) << "poll() failed: "sv << errno;
+              return false;
+            }
+
+            // Try to send again
+            continue;
+          }
+
+          // The datagrams are independent and may go to different peers, so skip the one
+          // that failed rather than dropping the rest of the batch with it
+          BOOST_LOG(warning) << "sendmmsg() failed: "sv << errno;
+          sent_all = false;
+          ++msgs_sent;
+          continue;
+        }
+
+        msgs_sent += sent;
+      }
+    }
+
+    return sent_all;
+  }
+
+  bool send(send_info_t &send_info) {
+    auto sockfd = (int) send_info.native_socket;
+
+    send_msg_storage_t storage;
+    struct msghdr msg;
+    fill_send_msg(send_info, storage, msg);
 
     auto bytes_sent = sendmsg(sockfd, &msg, 0);
 
@@ -764,6 +915,67 @@ namespace platf {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  bool enable_kernel_pacing(uintptr_t native_socket) {
+#ifdef SO_TXTIME
+    int sockfd = (int) native_socket;
+
+    // The fq qdisc paces packets based on CLOCK_MONOTONIC timestamps
+    struct sock_txtime txtime = {};
+    txtime.clockid = CLOCK_MONOTONIC;
+    txtime.flags = 0;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) != 0) {
+      BOOST_LOG(warning) << "Failed to set SO_TXTIME: "sv << errno;
+      return false;
+    }
+
+    return true;
+#else
+    BOOST_LOG(warning) << "Kernel pacing requires SO_TXTIME support"sv;
+    return false;
+#endif
+  }
+
+  class realtime_scheduling_t: public deinit_t {
+  public:
+    realtime_scheduling_t(pthread_t thread, int policy, sched_param param):
+        thread(thread),
+        policy(policy),
+        param(param) {
+    }
+
+    ~realtime_scheduling_t() override {
+      if (auto err = pthread_setschedparam(thread, policy, &param)) {
+        BOOST_LOG(warning) << "Unable to restore the scheduling policy, pthread_setschedparam() failed: "sv << err;
+      }
+    }
+
+  private:
+    pthread_t thread;
+    int policy;
+    sched_param param;
+  };
+
+  std::unique_ptr<deinit_t> enable_realtime_scheduling() {
+    auto thread = pthread_self();
+
+    int policy;
+    sched_param param;
+    if (auto err = pthread_getschedparam(thread, &policy, &param)) {
+      BOOST_LOG(warning) << "Unable to query the scheduling policy, pthread_getschedparam() failed: "sv << err;
+      return nullptr;
+    }
+
+    sched_param realtime_param {};
+    realtime_param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    if (auto err = pthread_setschedparam(thread, SCHED_FIFO, &realtime_param)) {
+      BOOST_LOG(warning) << "Unable to use SCHED_FIFO (missing CAP_SYS_NICE?), pthread_setschedparam() failed: "sv << err;
+      return nullptr;
+    }
+
+    return std::make_unique<realtime_scheduling_t>(thread, policy, param);
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -787,6 +999,7 @@ namespace platf {
 #ifdef SUNSHINE_BUILD_X11
       X11,  ///< X11
 #endif
+      SYNTHETIC,  ///< Generated test pattern
       MAX_FLAGS  ///< The maximum number of flags
     };
   }  // namespace source
@@ -829,7 +1042,13 @@ namespace platf {
   }
 #endif
 
+  std::vector<std::string> synthetic_display_names();
+  std::shared_ptr<display_t> synthetic_display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config);
+
   std::vector<std::string> display_names(mem_type_e hwdevice_type) {
+    if (sources[source::SYNTHETIC]) {
+      return synthetic_display_names();
+    }
 #ifdef SUNSHINE_BUILD_CUDA
     // display using NvFBC only supports mem_type_e::cuda
     if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
@@ -864,6 +1083,10 @@ namespace platf {
   }
 
   std::shared_ptr<display_t> display(mem_type_e hwdevice_type, const std::string &display_name, const video::config_t &config) {
+    if (sources[source::SYNTHETIC]) {
+      BOOST_LOG(info) << "Generating a synthetic test pattern instead of screencasting"sv;
+      return synthetic_display(hwdevice_type, display_name, config);
+    }
 #ifdef SUNSHINE_BUILD_CUDA
     if (sources[source::NVFBC] && hwdevice_type == mem_type_e::cuda) {
       BOOST_LOG(info) << "Screencasting with NvFBC"sv;
@@ -916,6 +1139,9 @@ namespace platf {
     }
 #endif
 
+    // Never picked automatically, as it doesn't capture anything, and cleared when
+    // initialized again with another capture method
+    sources[source::SYNTHETIC] = config::video.capture == "synthetic";
 #ifdef SUNSHINE_BUILD_CUDA
     if ((config::video.capture.empty() && sources.none()) || config::video.capture == "nvfbc") {
       if (verify_nvfbc()) {
@@ -961,13 +1187,45 @@ namespace platf {
 
   class linux_high_precision_timer: public high_precision_timer {
   public:
+    linux_high_precision_timer():
+        spin {std::chrono::microseconds {config::stream.pacing_spin_us}} {
+      // The default timer slack of 50us delays every wakeup far more than packet pacing can tolerate.
+      // Timer slack is a per-thread setting, so this applies to the thread creating the timer.
+      if (prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0) != 0) {
+        BOOST_LOG(warning) << "Unable to reduce timer slack, prctl() failed: "sv << errno;
+      }
+    }
+
     void sleep_for(const std::chrono::nanoseconds &duration) override {
-      std::this_thread::sleep_for(duration);
+      if (duration <= 0s) {
+        return;
+      }
+
+      // std::chrono::steady_clock is backed by CLOCK_MONOTONIC, so its time points can be
+      // used as absolute deadlines without drifting on EINTR or on the way into the kernel.
+      auto deadline = std::chrono::steady_clock::now() + duration;
+
+      if (duration > spin) {
+        auto wakeup = std::chrono::duration_cast<std::chrono::nanoseconds>((deadline - spin).time_since_epoch());
+
+        timespec ts;
+        ts.tv_sec = wakeup.count() / std::nano::den;
+        ts.tv_nsec = wakeup.count() % std::nano::den;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+      }
+
+      // Busy wait for the remainder, which hides the wakeup latency of the scheduler. The wait never
+      // exceeds the configured spin, even if clock_nanosleep() returned early with an error.
+      auto spin_end = std::min(deadline, std::chrono::steady_clock::now() + spin);
+      while (std::chrono::steady_clock::now() < spin_end) {}
     }
 
     operator bool() override {
       return true;
     }
+
+  private:
+    std::chrono::nanoseconds spin;
   };
 
   std::unique_ptr<high_precision_timer> create_high_precision_timer() {
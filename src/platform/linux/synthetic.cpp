@@ -0,0 +1,377 @@
+/**
+ * @file src/platform/linux/synthetic.cpp
+ * @brief Definitions for the synthetic display, which generates frames instead of capturing them.
+ */
+// standard includes
+#include <algorithm>
+#include <optional>
+#include <thread>
+
+// local includes
+#include "src/config.h"
+#include "src/logging.h"
+#include "src/platform/common.h"
+#include "src/video.h"
+
+using namespace std::literals;
+
+namespace platf {
+  /**
+   * @brief The content generated by the synthetic display.
+   */
+  enum class pattern_e {
+    desktop,  ///< A desktop that never changes
+    text,  ///< A terminal scrolling text up
+    noise,  ///< Random pixels, different in every frame
+    damage,  ///< A desktop with a moving window and a small video playing
+  };
+
+  /**
+   * @brief A rectangle of the image, in pixels.
+   */
+  struct rect_t {
+    int x;
+    int y;
+    int width;
+    int height;
+  };
+
+  struct synthetic_img_t: public img_t {
+    ~synthetic_img_t() override {
+      delete[] data;
+      data = nullptr;
+    }
+
+    // The images are recycled, so only what changed since they were last drawn needs drawing
+    bool drawn = false;
+    std::optional<rect_t> window;
+  };
+
+  // Every 8x16 cell of text shows a pseudo-glyph
+  constexpr int glyph_width = 8;
+  constexpr int glyph_height = 16;
+
+  /**
+   * @brief Mix the bits of a number, so nearby inputs give unrelated outputs.
+   */
+  static std::uint32_t mix(std::uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+  }
+
+  /**
+   * @brief Get the lit pixels of a row of a character of a line of text.
+   * @param line The line of text, its content and length are derived from it.
+   * @param column The position of the character within the line.
+   * @param row The row within the line, from 0 to glyph_height - 1.
+   * @param columns The maximum number of characters of a line.
+   * @return A bit for each of the glyph_width pixels of the row, the lowest bit being the leftmost pixel.
+   */
+  static std::uint8_t glyph_row(std::uint32_t line, int column, int row, int columns) {
+    if (column >= (int) (mix(line) % (std::uint32_t) columns)) {
+      return 0;
+    }
+
+    auto glyph = mix(line * 131 + column) % 64;
+    if (glyph < 12 || row < 3 || row > 12) {
+      return 0;  // A space, or the padding between lines
+    }
+
+    return mix(glyph * 17 + row) & 0x7e;
+  }
+
+  static std::uint32_t bgr(std::uint8_t r, std::uint8_t g, std::uint8_t b) {
+    return b | g << 8 | r << 16;
+  }
+
+  /**
+   * @brief Draw a row of a line of text.
+   * @param out The first pixel of the row.
+   * @param x The horizontal position within the line of the first pixel.
+   * @param count The number of pixels to draw.
+   */
+  static void draw_text_row(std::uint32_t *out, int x, int count, std::uint32_t line, int row, int columns, std::uint32_t fg, std::uint32_t bg) {
+    auto end = x + count;
+    while (x < end) {
+      auto column = x / glyph_width;
+      auto bits = glyph_row(line, column, row, columns);
+      auto cell_end = std::min((column + 1) * glyph_width, end);
+      for (; x < cell_end; ++x) {
+        *out++ = bits & (1 << (x % glyph_width)) ? fg : bg;
+      }
+    }
+  }
+
+  /**
+   * @brief A display that draws one of the test patterns of `pattern_e` at a fixed frame rate.
+   * @details Frames are generated in system memory, so they can be encoded on any host,
+   * including headless build machines without a GPU. The content of every frame only
+   * depends on its number, so runs can be compared with each other.
+   */
+  class synthetic_display_t: public display_t {
+  public:
+    int init(const ::video::config_t &config) {
+      delay = std::chrono::nanoseconds {1s} / config.framerate;
+
+      width = config.width;
+      height = config.height;
+      env_width = width;
+      env_height = height;
+
+      auto &name = ::config::video.synthetic_pattern;
+      if (name == "text"sv) {
+        pattern = pattern_e::text;
+      } else if (name == "noise"sv) {
+        pattern = pattern_e::noise;
+      } else if (name == "damage"sv) {
+        pattern = pattern_e::damage;
+      } else {
+        pattern = pattern_e::desktop;
+      }
+
+      BOOST_LOG(info) << "Generating the synthetic test pattern ["sv << name << ']';
+
+      return 0;
+    }
+
+    capture_e capture(const push_captured_image_cb_t &push_captured_image_cb, const pull_free_image_cb_t &pull_free_image_cb, bool *cursor) override {
+      auto next_frame = std::chrono::steady_clock::now();
+
+      sleep_overshoot_logger.reset();
+
+      while (true) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (next_frame > now) {
+          std::this_thread::sleep_for(next_frame - now);
+          sleep_overshoot_logger.first_point(next_frame);
+          sleep_overshoot_logger.second_point_now_and_log();
+        }
+
+        next_frame += delay;
+        if (next_frame < now) {  // some major slowdown happened; we couldn't keep up
+          next_frame = now + delay;
+        }
+
+        std::shared_ptr<platf::img_t> img_out;
+        if (!pull_free_image_cb(img_out)) {
+          return platf::capture_e::interrupted;
+        }
+
+        draw(*img_out, frame_number++);
+        img_out->frame_timestamp = std::chrono::steady_clock::now();
+
+        if (!push_captured_image_cb(std::move(img_out), true)) {
+          return platf::capture_e::ok;
+        }
+      }
+
+      return capture_e::ok;
+    }
+
+    std::shared_ptr<img_t> alloc_img() override {
+      auto img = std::make_shared<synthetic_img_t>();
+      img->width = width;
+      img->height = height;
+      img->pixel_pitch = 4;
+      img->row_pitch = img->pixel_pitch * width;
+      img->data = new std::uint8_t[height * img->row_pitch];
+
+      return img;
+    }
+
+    int dummy_img(img_t *img) override {
+      draw(*img, 0);
+      return 0;
+    }
+
+    std::unique_ptr<avcodec_encode_device_t> make_avcodec_encode_device(pix_fmt_e pix_fmt) override {
+      return std::make_unique<avcodec_encode_device_t>();
+    }
+
+  private:
+    /**
+     * @brief Draw a frame of the pattern in BGR0.
+     * @param img The image to draw into, allocated by `alloc_img()`.
+     * @param frame The number of the frame.
+     */
+    void draw(img_t &img, std::uint64_t frame) {
+      auto &synthetic_img = (synthetic_img_t &) img;
+
+      switch (pattern) {
+        case pattern_e::desktop:
+          if (!synthetic_img.drawn) {
+            draw_desktop(img, {0, 0, width, height});
+          }
+          break;
+        case pattern_e::text:
+          draw_text(img, frame);
+          break;
+        case pattern_e::noise:
+          draw_noise(img, {0, 0, width, height}, frame);
+          break;
+        case pattern_e::damage:
+          draw_damage(synthetic_img, frame);
+          break;
+      }
+
+      synthetic_img.drawn = true;
+    }
+
+    /**
+     * @brief Draw part of a desktop with a wallpaper, a taskbar and two windows full of text.
+     * @param img The image to draw into.
+     * @param rect The part of the desktop to draw.
+     */
+    void draw_desktop(img_t &img, const rect_t &rect) {
+      auto taskbar_top = height - std::max(height / 24, 1);
+
+      // The windows are placed relative to the size of the desktop
+      const rect_t windows[] {
+        {width / 16, height / 12, width / 2, height / 2},
+        {width * 7 / 16, height * 3 / 8, width / 2, height / 2},
+      };
+      auto title_height = std::max(height / 36, 1);
+
+      for (int y = rect.y; y < rect.y + rect.height; ++y) {
+        auto *row = (std::uint32_t *) (img.data + y * img.row_pitch);
+
+        if (y >= taskbar_top) {
+          std::fill_n(row + rect.x, rect.width, bgr(0x20, 0x20, 0x28));
+          continue;
+        }
+
+        auto wallpaper = bgr(0x10, (std::uint8_t) (0x30 + y * 0x60 / height), (std::uint8_t) (0x60 + y * 0x80 / height));
+
+        // Draw the row in spans covered by the same window, the last window being on top
+        for (int x = rect.x; x < rect.x + rect.width;) {
+          auto span_end = rect.x + rect.width;
+
+          int window_index = -1;
+          for (int w = 1; w >= 0; --w) {
+            auto &window = windows[w];
+            if (y < window.y || y >= window.y + window.height) {
+              continue;
+            }
+
+            if (x >= window.x && x < window.x + window.width) {
+              window_index = w;
+              span_end = std::min(span_end, window.x + window.width);
+              break;
+            }
+            if (window.x > x) {
+              span_end = std::min(span_end, window.x);
+            }
+          }
+
+          auto count = span_end - x;
+          if (window_index < 0) {
+            std::fill_n(row + x, count, wallpaper);
+          } else if (auto &window = windows[window_index]; y < window.y + title_height) {
+            std::fill_n(row + x, count, bgr(0x30, 0x50, 0x90));
+          } else {
+            auto text_y = y - window.y - title_height;
+            draw_text_row(row + x, x - window.x, count, window_index * 7919 + text_y / glyph_height, text_y % glyph_height, std::max(window.width / glyph_width, 1), bgr(0x10, 0x10, 0x10), bgr(0xf0, 0xf0, 0xf0));
+          }
+
+          x = span_end;
+        }
+      }
+    }
+
+    /**
+     * @brief Draw a terminal whose text scrolls up by 2 pixels every frame.
+     * @param img The image to draw into.
+     * @param frame The number of the frame.
+     */
+    void draw_text(img_t &img, std::uint64_t frame) {
+      auto scroll = frame * 2;
+      auto columns = std::max(width / glyph_width, 1);
+
+      for (int y = 0; y < height; ++y) {
+        auto *row = (std::uint32_t *) (img.data + y * img.row_pitch);
+        auto text_y = y + scroll;
+        auto line = (std::uint32_t) (text_y / glyph_height);
+        auto line_row = (int) (text_y % glyph_height);
+
+        draw_text_row(row, 0, width, line, line_row, columns, bgr(0xc0, 0xc0, 0xc0), bgr(0x0c, 0x0c, 0x0c));
+      }
+    }
+
+    /**
+     * @brief Fill a rectangle with random pixels, seeded by the frame number.
+     * @param img The image to draw into.
+     * @param rect The rectangle to fill.
+     * @param frame The number of the frame.
+     */
+    void draw_noise(img_t &img, const rect_t &rect, std::uint64_t frame) {
+      // xorshift64, which is enough to defeat any compression
+      std::uint64_t state = frame * 0x9e3779b97f4a7c15 + 1;
+
+      for (int y = rect.y; y < rect.y + rect.height; ++y) {
+        auto *row = (std::uint32_t *) (img.data + y * img.row_pitch);
+        for (int x = rect.x; x < rect.x + rect.width; ++x) {
+          state ^= state << 13;
+          state ^= state >> 7;
+          state ^= state << 17;
+          row[x] = (std::uint32_t) state & 0xffffff;
+        }
+      }
+    }
+
+    /**
+     * @brief Draw the desktop, with a window bouncing across it and a small video playing.
+     * @details Only the parts that changed since the image was last drawn are redrawn,
+     * like a compositor repainting its damaged regions.
+     * @param img The image to draw into.
+     * @param frame The number of the frame.
+     */
+    void draw_damage(synthetic_img_t &img, std::uint64_t frame) {
+      if (!img.drawn) {
+        draw_desktop(img, {0, 0, width, height});
+      } else if (img.window) {
+        draw_desktop(img, *img.window);
+      }
+
+      // Bounce the window back and forth, 8 pixels per frame
+      rect_t window {0, height / 5, std::max(width / 4, 1), std::max(height / 4, 1)};
+      auto travel = std::max(width - window.width, 1);
+      auto position = (int) (frame * 8 % (travel * 2));
+      window.x = position < travel ? position : travel * 2 - position;
+
+      for (int y = window.y; y < window.y + window.height; ++y) {
+        auto *row = (std::uint32_t *) (img.data + y * img.row_pitch);
+        std::fill_n(row + window.x, window.width, y < window.y + std::max(height / 36, 1) ? bgr(0x90, 0x30, 0x30) : bgr(0xe0, 0xe0, 0xd0));
+      }
+      img.window = window;
+
+      draw_noise(img, {width * 5 / 8, height * 5 / 8, std::max(width / 8, 1), std::max(height / 8, 1)}, frame);
+    }
+
+    std::chrono::nanoseconds delay;
+    std::uint64_t frame_number = 0;
+    pattern_e pattern;
+  };
+
+  std::vector<std::string> synthetic_display_names() {
+    return {"synthetic"s};
+  }
+
+  std::shared_ptr<display_t> synthetic_display(mem_type_e hwdevice_type, const std::string &display_name, const ::video::config_t &config) {
+    if (hwdevice_type != mem_type_e::system) {
+      BOOST_LOG(info) << "The synthetic display only supports software encoding"sv;
+      return nullptr;
+    }
+
+    auto disp = std::make_shared<synthetic_display_t>();
+    if (disp->init(config)) {
+      return nullptr;
+    }
+
+    return disp;
+  }
+}  // namespace platf
@@ -301,6 +301,21 @@ namespace platf {
     return false;
   }
 
+  int recv_batch(uintptr_t native_socket, std::span<recv_datagram_t> datagrams) {
+    // Fall back to unbatched receive calls
+    return -1;
+  }
+
+  bool send_many(std::span<send_info_t> send_infos) {
+    // Fall back to one send call per datagram
+    bool sent_all = true;
+    for (auto &send_info : send_infos) {
+      sent_all = send(send_info) && sent_all;
+    }
+
+    return sent_all;
+  }
+
   bool send(send_info_t &send_info) {
     auto sockfd = (int) send_info.native_socket;
     struct msghdr msg = {};
@@ -507,6 +522,16 @@ namespace platf {
     return std::make_unique<qos_t>(sockfd, reset_options);
   }
 
+  bool enable_kernel_pacing(uintptr_t native_socket) {
+    // Unsupported, the caller falls back to pacing in user space
+    return false;
+  }
+
+  std::unique_ptr<deinit_t> enable_realtime_scheduling() {
+    // Unsupported, the thread keeps its default scheduling
+    return nullptr;
+  }
+
   std::string get_host_name() {
     try {
       return boost::asio::ip::host_name();
@@ -1451,6 +1451,21 @@ namespace platf {
     return WSASendMsg((SOCKET) send_info.native_socket, &msg, 0, &bytes_sent, nullptr, nullptr) != SOCKET_ERROR;
   }
 
+  int recv_batch(uintptr_t native_socket, std::span<recv_datagram_t> datagrams) {
+    // Fall back to unbatched receive calls
+    return -1;
+  }
+
+  bool send_many(std::span<send_info_t> send_infos) {
+    // Fall back to one send call per datagram
+    bool sent_all = true;
+    for (auto &send_info : send_infos) {
+      sent_all = send(send_info) && sent_all;
+    }
+
+    return sent_all;
+  }
+
   bool send(send_info_t &send_info) {
     WSAMSG msg;
 
@@ -1665,6 +1680,16 @@ namespace platf {
     return std::make_unique<qos_t>(flow_id);
   }
 
+  bool enable_kernel_pacing(uintptr_t native_socket) {
+    // Unsupported, the caller falls back to pacing in user space
+    return false;
+  }
+
+  std::unique_ptr<deinit_t> enable_realtime_scheduling() {
+    // Unsupported, the thread keeps the priority set by adjust_thread_priority()
+    return nullptr;
+  }
+
   int64_t qpc_counter() {
     LARGE_INTEGER performance_counter;
     if (QueryPerformanceCounter(&performance_counter)) {
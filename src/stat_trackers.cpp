@@ -2,6 +2,11 @@
  * @file src/stat_trackers.cpp
  * @brief Definitions for streaming statistic tracking.
  */
+// standard includes
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
 // local includes
 #include "stat_trackers.h"
 
@@ -15,4 +20,138 @@ namespace stat_trackers {
     return boost::format("%1$.2f");
   }
 
+  /**
+   * @brief Get the value in the middle of a histogram bucket.
+   * @param index The bucket index.
+   * @return The value, scaled by histogram_t::resolution.
+   */
+  static double bucket_midpoint(int index) {
+    if (index < histogram_t::sub_buckets) {
+      return index;
+    }
+
+    auto shift = (index - histogram_t::sub_buckets) / histogram_t::sub_buckets;
+    auto sub_bucket = (index - histogram_t::sub_buckets) % histogram_t::sub_buckets;
+
+    auto lower = (double) ((std::uint64_t) (histogram_t::sub_buckets + sub_bucket) << shift);
+    auto width = (double) ((std::uint64_t) 1 << shift);
+    return lower + (width - 1) / 2;
+  }
+
+  int histogram_t::bucket_index(std::uint64_t scaled_value) {
+    if (scaled_value < sub_buckets) {
+      return (int) scaled_value;
+    }
+
+    // The top bits select the power of two, the following ones the linear sub-bucket within it
+    auto shift = std::bit_width(scaled_value) - 1 - sub_bucket_bits;
+    auto sub_bucket = (scaled_value >> shift) & (sub_buckets - 1);
+    return sub_buckets + shift * sub_buckets + (int) sub_bucket;
+  }
+
+  void histogram_t::record(double value) {
+    auto scaled_value = (std::uint64_t) std::clamp(std::round(value * resolution), 0.0, (double) std::numeric_limits<std::int64_t>::max());
+
+    counts[bucket_index(scaled_value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(scaled_value, std::memory_order_relaxed);
+
+    auto current_min = min.load(std::memory_order_relaxed);
+    while (scaled_value < current_min && !min.compare_exchange_weak(current_min, scaled_value, std::memory_order_relaxed)) {}
+
+    auto current_max = max.load(std::memory_order_relaxed);
+    while (scaled_value > current_max && !max.compare_exchange_weak(current_max, scaled_value, std::memory_order_relaxed)) {}
+
+    // Counted last, so a snapshot never sees more values than the buckets hold
+    count.fetch_add(1, std::memory_order_release);
+  }
+
+  histogram_t::snapshot_t histogram_t::snapshot() const {
+    snapshot_t snapshot;
+
+    snapshot.count = count.load(std::memory_order_acquire);
+    if (snapshot.count == 0) {
+      return snapshot;
+    }
+
+    for (int x = 0; x < buckets; ++x) {
+      snapshot.counts[x] = counts[x].load(std::memory_order_relaxed);
+    }
+
+    snapshot.sum = sum.load(std::memory_order_relaxed) / resolution;
+    snapshot.min = min.load(std::memory_order_relaxed) / resolution;
+    snapshot.max = max.load(std::memory_order_relaxed) / resolution;
+
+    return snapshot;
+  }
+
+  void histogram_t::reset() {
+    count.store(0, std::memory_order_relaxed);
+    for (auto &bucket_count : counts) {
+      bucket_count.store(0, std::memory_order_relaxed);
+    }
+
+    sum.store(0, std::memory_order_relaxed);
+    min.store(std::numeric_limits<std::uint64_t>::max(), std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+  }
+
+  double histogram_t::bucket_upper_bound(int index) {
+    if (index < sub_buckets) {
+      return (index + 1) / resolution;
+    }
+
+    auto shift = (index - sub_buckets) / sub_buckets;
+    auto sub_bucket = (index - sub_buckets) % sub_buckets;
+
+    return std::ldexp(sub_buckets + sub_bucket + 1, shift) / resolution;
+  }
+
+  double histogram_t::snapshot_t::percentile(double p) const {
+    if (count == 0) {
+      return 0;
+    }
+
+    auto rank = std::max<std::uint64_t>(1, (std::uint64_t) std::ceil(std::clamp(p, 0.0, 100.0) / 100.0 * count));
+
+    std::uint64_t seen = 0;
+    for (int x = 0; x < buckets; ++x) {
+      seen += counts[x];
+      if (seen >= rank) {
+        return std::clamp(bucket_midpoint(x) / resolution, min, max);
+      }
+    }
+
+    return max;
+  }
+
+  double histogram_t::snapshot_t::mean() const {
+    return count ? sum / count : 0;
+  }
+
+  histogram_t::snapshot_t histogram_t::snapshot_t::since(const snapshot_t &earlier) const {
+    snapshot_t snapshot;
+
+    int first = -1;
+    int last = -1;
+    for (int x = 0; x < buckets; ++x) {
+      // Buckets only ever grow, but a snapshot may race a record(), so never wrap around
+      snapshot.counts[x] = counts[x] - std::min(counts[x], earlier.counts[x]);
+      if (snapshot.counts[x]) {
+        snapshot.count += snapshot.counts[x];
+        first = first < 0 ? x : first;
+        last = x;
+      }
+    }
+
+    if (snapshot.count == 0) {
+      return snapshot;
+    }
+
+    snapshot.sum = std::max(0.0, sum - earlier.sum);
+    snapshot.min = std::max(first ? bucket_upper_bound(first - 1) : 0.0, min);
+    snapshot.max = std::min(bucket_upper_bound(last), max);
+
+    return snapshot;
+  }
+
 }  // namespace stat_trackers
@@ -5,7 +5,10 @@
 #pragma once
 
 // standard includes
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <functional>
 #include <limits>
 
@@ -18,36 +21,114 @@ namespace stat_trackers {
 
   boost::format two_digits_after_decimal();
 
-  template<typename T>
-  class min_max_avg_tracker {
+  /**
+   * @brief A lock-free histogram of non-negative values, with log-linear buckets.
+   * @details Values are recorded with a resolution of 1/1000 of their unit. Every power of two
+   * is split into 8 linear sub-buckets, so percentiles are reported within 6.25% of the values
+   * they stand for. Any thread may record values while other threads take snapshots.
+   */
+  class histogram_t {
   public:
-    using callback_function = std::function<void(T stat_min, T stat_max, double stat_avg)>;
-
-    void collect_and_callback_on_interval(T stat, const callback_function &callback, std::chrono::seconds interval_in_seconds) {
-      if (data.calls == 0) {
-        data.last_callback_time = std::chrono::steady_clock::now();
-      } else if (std::chrono::steady_clock::now() > data.last_callback_time + interval_in_seconds) {
-        callback(data.stat_min, data.stat_max, data.stat_total / data.calls);
-        data = {};
+    static constexpr int sub_bucket_bits = 3;
+    static constexpr int sub_buckets = 1 << sub_bucket_bits;
+    static constexpr int buckets = sub_buckets + (64 - sub_bucket_bits) * sub_buckets;
+    static constexpr double resolution = 1000.0;
+
+    /**
+     * @brief A copy of the histogram at one point in time.
+     */
+    struct snapshot_t {
+      std::array<std::uint64_t, buckets> counts {};
+      std::uint64_t count = 0;
+      double sum = 0;
+      double min = 0;
+      double max = 0;
+
+      /**
+       * @brief Get the value below which a given share of the recorded values fall.
+       * @param p The percentile, from 0 to 100.
+       * @return The percentile, or 0 if nothing was recorded.
+       */
+      double percentile(double p) const;
+
+      /**
+       * @brief Get the average of the recorded values.
+       * @return The average, or 0 if nothing was recorded.
+       */
+      double mean() const;
+
+      /**
+       * @brief Get the values recorded between an earlier snapshot of the same histogram and this one.
+       * @details The minimum and maximum are only known down to the bounds of their buckets.
+       * @param earlier The earlier snapshot.
+       * @return The snapshot of the values recorded in between.
+       */
+      snapshot_t since(const snapshot_t &earlier) const;
+    };
+
+    /**
+     * @brief Record a value, negative values are recorded as 0.
+     * @param value The value to record.
+     */
+    void record(double value);
+
+    /**
+     * @brief Copy the histogram.
+     * @return The snapshot.
+     */
+    snapshot_t snapshot() const;
+
+    /**
+     * @brief Forget all recorded values.
+     * @details Values recorded by other threads while resetting may be partially kept.
+     */
+    void reset();
+
+    /**
+     * @brief Get the exclusive upper bound of a bucket.
+     * @param index The bucket index.
+     * @return The upper bound, in the unit of the recorded values.
+     */
+    static double bucket_upper_bound(int index);
+
+  private:
+    static int bucket_index(std::uint64_t scaled_value);
+
+    std::array<std::atomic_uint64_t, buckets> counts {};
+    std::atomic_uint64_t count {0};
+    std::atomic_uint64_t sum {0};
+    std::atomic_uint64_t min {std::numeric_limits<std::uint64_t>::max()};
+    std::atomic_uint64_t max {0};
+  };
+
+  /**
+   * @brief Collects values into a histogram, and hands its snapshot to a callback once per interval.
+   * @details Memory use is fixed, no matter how many values are collected.
+   */
+  class percentile_tracker {
+  public:
+    using callback_function = std::function<void(const histogram_t::snapshot_t &snapshot)>;
+
+    void collect_and_callback_on_interval(double stat, const callback_function &callback, std::chrono::seconds interval_in_seconds) {
+      if (calls == 0) {
+        last_callback_time = std::chrono::steady_clock::now();
+      } else if (std::chrono::steady_clock::now() > last_callback_time + interval_in_seconds) {
+        callback(histogram.snapshot());
+        reset();
       }
-      data.stat_min = std::min(data.stat_min, stat);
-      data.stat_max = std::max(data.stat_max, stat);
-      data.stat_total += stat;
-      data.calls += 1;
+      histogram.record(stat);
+      calls += 1;
     }
 
     void reset() {
-      data = {};
+      histogram.reset();
+      calls = 0;
     }
 
   private:
-    struct {
-      std::chrono::steady_clock::time_point last_callback_time = std::chrono::steady_clock::now();
-      T stat_min = std::numeric_limits<T>::max();
-      T stat_max = std::numeric_limits<T>::min();
-      double stat_total = 0;
-      uint32_t calls = 0;
-    } data;
+    std::chrono::steady_clock::time_point last_callback_time = std::chrono::steady_clock::now();
+    histogram_t histogram;
+    std::uint32_t calls = 0;
   };
 
 }  // namespace stat_trackers
@@ -0,0 +1,342 @@
+/**
+ * @file src/stats.cpp
+ * @brief Definitions for the live streaming statistics registry.
+ */
+// standard includes
+#include <cmath>
+#include <format>
+#include <mutex>
+#include <vector>
+
+// local includes
+#include "stats.h"
+
+namespace stats {
+  using namespace std::literals;
+
+  // Rates are averaged over at least this long, no matter how often they are requested
+  constexpr auto rate_interval = 1s;
+
+  // Latency percentiles are reported over windows of at least this long, like the periodic loggers do
+  constexpr auto latency_window = 20s;
+
+  constexpr std::size_t latency_stages = 7;
+
+  using latency_snapshots_t = std::array<stat_trackers::histogram_t::snapshot_t, latency_stages>;
+
+  /**
+   * @brief A tracked session, along with the state needed to turn its counters into rates
+   * and its cumulative latency histograms into windows.
+   */
+  struct entry_t {
+    const void *key;
+    std::shared_ptr<session_stats_t> stats;
+
+    std::chrono::steady_clock::time_point sampled_at;
+    std::uint64_t sampled_frames = 0;
+    std::uint64_t sampled_bytes = 0;
+
+    double fps = 0;
+    double bitrate_kbps = 0;
+
+    std::chrono::steady_clock::time_point window_started_at;
+    std::unique_ptr<latency_snapshots_t> window_start = std::make_unique<latency_snapshots_t>();
+
+    // Empty until the first window is complete
+    std::unique_ptr<latency_snapshots_t> last_window;
+    double last_window_s = 0;
+  };
+
+  static std::mutex registry_lock;
+  static std::vector<entry_t> registry;
+  static std::uint64_t next_session_id = 1;
+
+  std::shared_ptr<session_stats_t> add_session(const void *key, std::string client) {
+    auto stats = std::make_shared<session_stats_t>();
+    stats->client = std::move(client);
+
+    std::lock_guard lg {registry_lock};
+    stats->id = next_session_id++;
+    registry.emplace_back(entry_t {key, stats, stats->started_at});
+    registry.back().window_started_at = stats->started_at;
+
+    return stats;
+  }
+
+  void remove_session(const void *key) {
+    std::lock_guard lg {registry_lock};
+    std::erase_if(registry, [key](const entry_t &entry) {
+      return entry.key == key;
+    });
+  }
+
+  std::shared_ptr<session_stats_t> find_session(const void *key) {
+    std::lock_guard lg {registry_lock};
+    for (auto &entry : registry) {
+      if (entry.key == key) {
+        return entry.stats;
+      }
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * @brief Update the rates of a session if enough time has passed since they were last updated.
+   * @param entry The session, the registry must be locked.
+   */
+  static void update_rates(entry_t &entry) {
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>(now - entry.sampled_at).count();
+    if (now - entry.sampled_at < rate_interval) {
+      return;
+    }
+
+    auto frames = entry.stats->video.sent.load(std::memory_order_relaxed);
+    auto bytes = entry.stats->video.bytes.load(std::memory_order_relaxed) + entry.stats->audio.bytes.load(std::memory_order_relaxed);
+
+    entry.fps = (frames - entry.sampled_frames) / elapsed;
+    entry.bitrate_kbps = (bytes - entry.sampled_bytes) * 8 / elapsed / 1000;
+
+    entry.sampled_at = now;
+    entry.sampled_frames = frames;
+    entry.sampled_bytes = bytes;
+  }
+
+  /**
+   * @brief The latency histograms of a session, along with their names.
+   * @param stats The statistics of the session.
+   * @return The names and histograms.
+   */
+  static auto latencies(session_stats_t &stats) {
+    return std::array<std::pair<std::string_view, stat_trackers::histogram_t *>, latency_stages> {{
+      {"encode"sv, &stats.encode_latency},
+      {"frame_processing"sv, &stats.frame_processing_latency},
+      {"fec"sv, &stats.fec_latency},
+      {"send_batch"sv, &stats.send_batch_latency},
+      {"network"sv, &stats.network_latency},
+      {"video_queue"sv, &stats.video.queue_delay},
+      {"audio_queue"sv, &stats.audio.queue_delay},
+    }};
+  }
+
+  /**
+   * @brief Complete the latency window of a session if it has lasted long enough.
+   * @param entry The session, the registry must be locked.
+   */
+  static void update_latency_window(entry_t &entry) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - entry.window_started_at < latency_window) {
+      return;
+    }
+
+    if (!entry.last_window) {
+      entry.last_window = std::make_unique<latency_snapshots_t>();
+    }
+
+    auto stages = latencies(*entry.stats);
+    for (std::size_t x = 0; x < latency_stages; ++x) {
+      auto snapshot = stages[x].second->snapshot();
+      (*entry.last_window)[x] = snapshot.since((*entry.window_start)[x]);
+      (*entry.window_start)[x] = snapshot;
+    }
+
+    entry.last_window_s = std::chrono::duration<double>(now - entry.window_started_at).count();
+    entry.window_started_at = now;
+  }
+
+  constexpr std::array<std::pair<std::string_view, double>, 4> quantiles {{
+    {"p50"sv, 50},
+    {"p90"sv, 90},
+    {"p99"sv, 99},
+    {"p999"sv, 99.9},
+  }};
+
+  static nlohmann::json stream_to_json(const stream_stats_t &stream) {
+    nlohmann::json tree;
+    tree["sent"] = stream.sent.load(std::memory_order_relaxed);
+    tree["bytes"] = stream.bytes.load(std::memory_order_relaxed);
+    tree["dropped"] = stream.dropped.load(std::memory_order_relaxed);
+    tree["queue_depth"] = stream.queue_depth.load(std::memory_order_relaxed);
+    return tree;
+  }
+
+  nlohmann::json to_json() {
+    std::lock_guard lg {registry_lock};
+
+    auto sessions = nlohmann::json::array();
+    for (auto &entry : registry) {
+      update_rates(entry);
+      update_latency_window(entry);
+      auto &stats = *entry.stats;
+
+      auto uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - stats.started_at).count();
+
+      nlohmann::json session;
+      session["id"] = stats.id;
+      session["client"] = stats.client;
+      session["uptime_s"] = uptime;
+      session["fps"] = entry.fps;
+      session["bitrate_kbps"] = entry.bitrate_kbps;
+      session["fec_percentage"] = stats.fec_percentage.load(std::memory_order_relaxed);
+      session["video"] = stream_to_json(stats.video);
+      session["audio"] = stream_to_json(stats.audio);
+
+      // Until the first window is complete, the latencies cover the whole session
+      session["latency_window_s"] = entry.last_window ? entry.last_window_s : uptime;
+
+      nlohmann::json latency_tree;
+      auto stages = latencies(stats);
+      for (std::size_t x = 0; x < latency_stages; ++x) {
+        auto &[name, histogram] = stages[x];
+        auto snapshot = entry.last_window ? (*entry.last_window)[x] : histogram->snapshot();
+
+        nlohmann::json histogram_tree;
+        histogram_tree["count"] = snapshot.count;
+        histogram_tree["mean"] = snapshot.mean();
+        histogram_tree["max"] = snapshot.max;
+        for (auto &[quantile_name, quantile] : quantiles) {
+          histogram_tree[quantile_name] = snapshot.percentile(quantile);
+        }
+
+        // The raw buckets, as [exclusive upper bound, count] pairs, empty buckets left out
+        auto buckets = nlohmann::json::array();
+        for (int x = 0; x < stat_trackers::histogram_t::buckets; ++x) {
+          if (snapshot.counts[x]) {
+            buckets.push_back({stat_trackers::histogram_t::bucket_upper_bound(x), snapshot.counts[x]});
+          }
+        }
+        histogram_tree["buckets"] = std::move(buckets);
+
+        latency_tree[name] = histogram_tree;
+      }
+      session["latency_ms"] = latency_tree;
+
+      sessions.push_back(session);
+    }
+
+    nlohmann::json tree;
+    tree["sessions"] = sessions;
+    return tree;
+  }
+
+  // The Prometheus buckets of the latencies, in ms, from 0.128ms to about 1s
+  static const auto latency_bucket_bounds = []() {
+    std::array<double, 14> bounds;
+    for (std::size_t x = 0; x < bounds.size(); ++x) {
+      bounds[x] = std::ldexp(1.0, (int) x + 7) / stat_trackers::histogram_t::resolution;
+    }
+    return bounds;
+  }();
+
+  /**
+   * @brief Escape a Prometheus label value.
+   * @param value The label value.
+   * @return The escaped label value.
+   */
+  static std::string escape_label(std::string_view value) {
+    std::string escaped;
+    for (auto ch : value) {
+      if (ch == '\\' || ch == '"') {
+        escaped += '\\';
+      } else if (ch == '\n') {
+        escaped += "\\n";
+        continue;
+      }
+      escaped += ch;
+    }
+
+    return escaped;
+  }
+
+  std::string to_prometheus() {
+    std::lock_guard lg {registry_lock};
+
+    std::string out;
+
+    // Every metric is written for all sessions at once, as its samples must be grouped together
+    auto metric = [&](std::string_view name, std::string_view type, std::string_view help, auto &&value_of) {
+      out += std::format("# HELP sunshine_{} {}\n# TYPE sunshine_{} {}\n", name, help, name, type);
+      for (auto &entry : registry) {
+        auto labels = std::format("session=\"{}\",client=\"{}\"", entry.stats->id, escape_label(entry.stats->client));
+        value_of(entry, labels);
+      }
+    };
+
+    auto counter = [&](std::string_view name, std::string_view help, auto &&value_of) {
+      metric(name, "counter"sv, help, [&](entry_t &entry, const std::string &labels) {
+        out += std::format("sunshine_{}{{{}}} {}\n", name, labels, value_of(*entry.stats));
+      });
+    };
+
+    auto gauge = [&](std::string_view name, std::string_view help, auto &&value_of) {
+      metric(name, "gauge"sv, help, [&](entry_t &entry, const std::string &labels) {
+        out += std::format("sunshine_{}{{{}}} {}\n", name, labels, value_of(entry));
+      });
+    };
+
+    counter("video_frames_sent_total"sv, "Video frames sent to the client."sv, [](session_stats_t &stats) {
+      return stats.video.sent.load(std::memory_order_relaxed);
+    });
+    counter("video_bytes_sent_total"sv, "Video bytes sent to the client, including FEC and headers."sv, [](session_stats_t &stats) {
+      return stats.video.bytes.load(std::memory_order_relaxed);
+    });
+    counter("video_frames_dropped_total"sv, "Video frames dropped by a full queue."sv, [](session_stats_t &stats) {
+      return stats.video.dropped.load(std::memory_order_relaxed);
+    });
+    counter("audio_packets_sent_total"sv, "Audio packets sent to the client."sv, [](session_stats_t &stats) {
+      return stats.audio.sent.load(std::memory_order_relaxed);
+    });
+    counter("audio_bytes_sent_total"sv, "Audio bytes sent to the client, including FEC and headers."sv, [](session_stats_t &stats) {
+      return stats.audio.bytes.load(std::memory_order_relaxed);
+    });
+    counter("audio_packets_dropped_total"sv, "Audio packets dropped by a full queue."sv, [](session_stats_t &stats) {
+      return stats.audio.dropped.load(std::memory_order_relaxed);
+    });
+
+    for (auto &entry : registry) {
+      update_rates(entry);
+    }
+    gauge("fps"sv, "Video frames sent per second."sv, [](entry_t &entry) {
+      return entry.fps;
+    });
+    gauge("bitrate_kbps"sv, "Video and audio bitrate in kbit/s."sv, [](entry_t &entry) {
+      return entry.bitrate_kbps;
+    });
+    gauge("fec_percentage"sv, "Share of video FEC shards, in percent."sv, [](entry_t &entry) {
+      return entry.stats->fec_percentage.load(std::memory_order_relaxed);
+    });
+    gauge("video_queue_depth"sv, "Video frames waiting to be sent."sv, [](entry_t &entry) {
+      return entry.stats->video.queue_depth.load(std::memory_order_relaxed);
+    });
+    gauge("audio_queue_depth"sv, "Audio packets waiting to be sent."sv, [](entry_t &entry) {
+      return entry.stats->audio.queue_depth.load(std::memory_order_relaxed);
+    });
+
+    // Cumulative over the session, so Prometheus can compute the percentiles of any window with histogram_quantile()
+    metric("latency_ms"sv, "histogram"sv, "Streaming latencies in ms since the session started, by stage."sv, [&](entry_t &entry, const std::string &labels) {
+      for (auto &[name, histogram] : latencies(*entry.stats)) {
+        auto snapshot = histogram->snapshot();
+
+        // Every power of two is a bucket bound, so the fixed bounds below are exact
+        std::uint64_t cumulative = 0;
+        int bucket = 0;
+        for (auto bound : latency_bucket_bounds) {
+          for (; bucket < stat_trackers::histogram_t::buckets && stat_trackers::histogram_t::bucket_upper_bound(bucket) <= bound; ++bucket) {
+            cumulative += snapshot.counts[bucket];
+          }
+          out += std::format("sunshine_latency_ms_bucket{{{},stage=\"{}\",le=\"{}\"}} {}\n", labels, name, bound, cumulative);
+        }
+        for (; bucket < stat_trackers::histogram_t::buckets; ++bucket) {
+          cumulative += snapshot.counts[bucket];
+        }
+
+        out += std::format("sunshine_latency_ms_bucket{{{},stage=\"{}\",le=\"+Inf\"}} {}\n", labels, name, cumulative);
+        out += std::format("sunshine_latency_ms_sum{{{},stage=\"{}\"}} {}\n", labels, name, snapshot.sum);
+        out += std::format("sunshine_latency_ms_count{{{},stage=\"{}\"}} {}\n", labels, name, cumulative);
+      }
+    });
+
+    return out;
+  }
+}  // namespace stats
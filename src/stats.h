@@ -0,0 +1,88 @@
+/**
+ * @file src/stats.h
+ * @brief Declarations for the live streaming statistics registry.
+ */
+#pragma once
+
+// standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "stat_trackers.h"
+
+namespace stats {
+
+  /**
+   * @brief Live statistics of the video or audio stream of a session.
+   */
+  struct stream_stats_t {
+    std::atomic_uint64_t sent {0};  ///< Frames (video) or packets (audio) sent to the client
+    std::atomic_uint64_t bytes {0};  ///< Bytes put on the wire, including FEC and headers
+    std::atomic_uint64_t dropped {0};  ///< Frames or packets dropped by a full queue
+    std::atomic_uint32_t queue_depth {0};  ///< Frames or packets queued behind the last one sent
+    stat_trackers::histogram_t queue_delay;  ///< Time between encoding and sending, in ms
+  };
+
+  /**
+   * @brief Live statistics of a streaming session.
+   * @details The streaming threads update these with relaxed atomics only, so reading them
+   * never slows down a stream.
+   */
+  struct session_stats_t {
+    std::uint64_t id;
+    std::string client;
+    std::chrono::steady_clock::time_point started_at = std::chrono::steady_clock::now();
+
+    stream_stats_t video;
+    stream_stats_t audio;
+
+    std::atomic_int fec_percentage {0};
+
+    // All latencies are in ms
+    stat_trackers::histogram_t encode_latency;
+    stat_trackers::histogram_t frame_processing_latency;
+    stat_trackers::histogram_t fec_latency;
+    stat_trackers::histogram_t send_batch_latency;
+    stat_trackers::histogram_t network_latency;
+  };
+
+  /**
+   * @brief Start tracking the statistics of a session.
+   * @param key Identifies the session to the other functions of this namespace.
+   * @param client The address of the client.
+   * @return The statistics of the session.
+   */
+  std::shared_ptr<session_stats_t> add_session(const void *key, std::string client);
+
+  /**
+   * @brief Stop tracking the statistics of a session.
+   * @param key The key the session was added with.
+   */
+  void remove_session(const void *key);
+
+  /**
+   * @brief Find the statistics of a session.
+   * @param key The key the session was added with.
+   * @return The statistics of the session, or nullptr if it isn't tracked.
+   */
+  std::shared_ptr<session_stats_t> find_session(const void *key);
+
+  /**
+   * @brief Get the statistics of all sessions as JSON.
+   * @return The statistics.
+   */
+  nlohmann::json to_json();
+
+  /**
+   * @brief Get the statistics of all sessions in the Prometheus text exposition format.
+   * @return The statistics.
+   */
+  std::string to_prometheus();
+}  // namespace stats
@@ -4,9 +4,13 @@
  */
 
 // standard includes
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <future>
 #include <queue>
+#include <span>
+#include <unordered_map>
 
 // lib includes
 #include <boost/endian/arithmetic.hpp>
@@ -28,10 +32,13 @@ extern "C" {
 #include "network.h"
 #include "platform/common.h"
 #include "process.h"
+#include "stats.h"
 #include "stream.h"
 #include "sync.h"
 #include "system_tray.h"
+#include "thread_pool.h"
 #include "thread_safe.h"
+#include "trace.h"
 #include "utility.h"
 
 #define IDX_START_A 0
@@ -245,6 +252,171 @@ namespace stream {
   using message_queue_t = std::shared_ptr<safe::queue_t<std::pair<udp::endpoint, std::string>>>;
   using message_queue_queue_t = std::shared_ptr<safe::queue_t<std::tuple<socket_e, av_session_id_t, message_queue_t>>>;
 
+  // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
+  constexpr auto MAX_FEC_BLOCKS = 4;
+
+  namespace fec {
+    using rs_t = util::safe_ptr<reed_solomon, [](reed_solomon *rs) {
+      reed_solomon_release(rs);
+    }>;
+
+    struct fec_t {
+      size_t data_shards;
+      size_t nr_shards;
+      size_t percentage;
+
+      size_t blocksize;
+      size_t prefixsize;
+      char *headers;
+      uint8_t **shards_p;
+
+      std::vector<platf::buffer_descriptor_t> &payload_buffers;
+
+      char *data(size_t el) const {
+        return (char *) shards_p[el];
+      }
+
+      char *prefix(size_t el) const {
+        return prefixsize ? &headers[el * prefixsize] : nullptr;
+      }
+
+      size_t size() const {
+        return nr_shards;
+      }
+    };
+
+    /**
+     * @brief Per-session scratch memory used to packetize video frames.
+     * @details The header-prefixed data shards of a frame are laid out back to back,
+     * followed by the parity shards of every FEC block. The buffers only ever grow,
+     * so once a session has seen its largest frame no further allocations are made.
+     */
+    struct shard_arena_t {
+      util::buffer_t<char> shards;
+      util::buffer_t<char> headers;
+      util::buffer_t<uint8_t *> shards_p;
+
+      std::array<std::vector<platf::buffer_descriptor_t>, MAX_FEC_BLOCKS> payload_buffers;
+
+      // Source buffers that make up the frame after replacements have been applied
+      std::vector<std::string_view> segments;
+
+      /**
+       * @brief Ensure the arena can hold the given number of shards.
+       * @param nr_shards The total number of data and parity shards.
+       * @param blocksize The size of each shard.
+       * @param prefixsize The size of the encryption prefix of each shard.
+       */
+      void reserve(size_t nr_shards, size_t blocksize, size_t prefixsize) {
+        grow(shards, nr_shards * blocksize);
+        grow(headers, nr_shards * prefixsize);
+        grow(shards_p, nr_shards);
+      }
+
+    private:
+      template<class T>
+      static void grow(util::buffer_t<T> &buffer, size_t elements) {
+        if (buffer.size() < elements) {
+          // Leave some headroom so slowly growing frames don't reallocate every time
+          buffer = util::buffer_t<T> {elements + elements / 4};
+        }
+      }
+    };
+
+    /**
+     * @brief Get a Reed-Solomon codec for the given shard geometry.
+     * @details Building the encoding matrix costs far more than encoding a block with it,
+     * and only a handful of geometries are seen during a stream, so the codecs are cached
+     * per thread and reused for every following frame.
+     * @param data_shards The number of data shards.
+     * @param parity_shards The number of parity shards.
+     * @return The codec, owned by the cache of the calling thread.
+     */
+    reed_solomon *codec_for(size_t data_shards, size_t parity_shards) {
+      thread_local std::unordered_map<std::uint32_t, rs_t> codecs;
+
+      // Both shard counts are limited to DATA_SHARDS_MAX
+      auto &rs = codecs[(std::uint32_t) (data_shards << 8 | parity_shards)];
+      if (!rs) {
+        rs.reset(reed_solomon_new(data_shards, parity_shards));
+      }
+
+      return rs.get();
+    }
+
+    /**
+     * @brief Compute the number of parity shards for a FEC block.
+     * @param data_shards The number of data shards in the block.
+     * @param fecpercentage The FEC percentage, raised if needed to meet the parity shard minimum.
+     * @param minparityshards The minimum number of parity shards.
+     * @return The number of parity shards.
+     */
+    static size_t parity_shards_for(size_t data_shards, size_t &fecpercentage, size_t minparityshards) {
+      auto parity_shards = (data_shards * fecpercentage + 99) / 100;
+
+      // increase the FEC percentage for this frame if the parity shard minimum is not met
+      if (parity_shards < minparityshards && fecpercentage != 0) {
+        parity_shards = minparityshards;
+        fecpercentage = (100 * parity_shards) / data_shards;
+      }
+
+      return parity_shards;
+    }
+
+    /**
+     * @brief Generate the parity shards for a block of data shards.
+     * @param payload The data shards, which must be aligned to blocksize.
+     * @param parity The buffer receiving the parity shards.
+     * @param shards_p Storage for the shard pointers of this block.
+     * @param headers Storage for the encryption prefixes of this block.
+     * @param payload_buffers Receives the buffer descriptors for sending this block.
+     * @param blocksize The size of each shard.
+     * @param fecpercentage The FEC percentage.
+     * @param minparityshards The minimum number of parity shards.
+     * @param prefixsize The size of the encryption prefix of each shard.
+     */
+    static fec_t encode(const std::string_view &payload, char *parity, uint8_t **shards_p, char *headers, std::vector<platf::buffer_descriptor_t> &payload_buffers, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
+      auto data_shards = payload.size() / blocksize;
+
+      auto requested_percentage = fecpercentage;
+      auto parity_shards = parity_shards_for(data_shards, fecpercentage, minparityshards);
+      if (fecpercentage != requested_percentage) {
+        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
+      }
+
+      auto nr_shards = data_shards + parity_shards;
+
+      // Point into the payload buffer for the data shards and into the parity buffer for the rest
+      for (auto x = 0; x < data_shards; ++x) {
+        shards_p[x] = (uint8_t *) &payload[x * blocksize];
+      }
+
+      payload_buffers.clear();
+      payload_buffers.emplace_back(std::begin(payload), payload.size());
+
+      if (fecpercentage != 0) {
+        for (auto x = 0; x < parity_shards; ++x) {
+          shards_p[data_shards + x] = (uint8_t *) &parity[x * blocksize];
+        }
+        payload_buffers.emplace_back(parity, parity_shards * blocksize);
+
+        // packets = parity_shards + data_shards
+        reed_solomon_encode(codec_for(data_shards, parity_shards), shards_p, nr_shards, blocksize);
+      }
+
+      return {
+        data_shards,
+        nr_shards,
+        fecpercentage,
+        blocksize,
+        prefixsize,
+        headers,
+        shards_p,
+        payload_buffers,
+      };
+    }
+  }  // namespace fec
+
   // return bytes written on success
   // return -1 on error
   static inline int encode_audio(bool encrypted, const audio::buffer_t &plaintext, uint8_t *destination, crypto::aes_t &iv, crypto::cipher::cbc_t &cbc) {
@@ -267,8 +439,24 @@ namespace stream {
   public:
     int bind(net::af_e address_family, std::uint16_t port) {
       _host = net::host_create(address_family, _addr, port);
+      if (!_host) {
+        return -1;
+      }
 
-      return !(bool) _host;
+      // wake() sends datagrams to this loopback socket to interrupt iterate()
+      boost::system::error_code ec;
+      _wake_sock.open(udp::v4(), ec);
+      _wake_sock.bind(udp::endpoint {asio::ip::address_v4::loopback(), 0}, ec);
+      _wake_sock.non_blocking(true, ec);
+      if (ec) {
+        BOOST_LOG(error) << "Couldn't create control stream wakeup socket: "sv << ec.message();
+
+        return -1;
+      }
+
+      _wake_endpoint = _wake_sock.local_endpoint();
+
+      return 0;
     }
 
     // Get session associated with address.
@@ -281,8 +469,23 @@ namespace stream {
     //   session refers to broadcast_ctx_t
     //   broadcast_ctx_t refers to control_server_t
     // Therefore, iterate is implemented further down the source file
+    /**
+     * @brief Wait for control stream traffic or a call to wake(), then handle all pending ENet events.
+     * @param timeout The maximum time to wait.
+     */
     void iterate(std::chrono::milliseconds timeout);
 
+    /**
+     * @brief Interrupt iterate(), so the control thread handles newly queued messages right away.
+     * @details Safe to call from any thread.
+     */
+    void wake() {
+      std::lock_guard lg {_wake_lock};
+
+      boost::system::error_code ec;
+      _wake_sock.send_to(asio::buffer("", 1), _wake_endpoint, 0, ec);
+    }
+
     /**
      * @brief Call the handler for a given control stream message.
      * @param type The message type.
@@ -322,6 +525,11 @@ namespace stream {
 
     ENetAddress _addr;
     net::host_t _host;
+
+    asio::io_context _wake_io;
+    udp::socket _wake_sock {_wake_io};
+    udp::endpoint _wake_endpoint;
+    std::mutex _wake_lock;
   };
 
   struct broadcast_ctx_t {
@@ -338,6 +546,227 @@ namespace stream {
     udp::socket audio_sock {io_context};
 
     control_server_t control_server;
+
+    // Shared by the video send threads of all sessions
+    bool kernel_pacing = false;
+  };
+
+  /**
+   * @brief Per-session budget for pacing video packets.
+   * @details The budget starts at the link rate and is lowered multiplicatively while the
+   * client reports packet loss, down to a floor that still drains the requested bitrate
+   * comfortably. Once the losses stop, it recovers additively back to the link rate.
+   */
+  class pacing_budget_t {
+  public:
+    /**
+     * @brief Initialize the budget for a session.
+     * @param bitrate_kbps The video bitrate requested by the client in kilobits per second.
+     * @param link_rate_mbps The configured link rate in megabits per second, or 0 for 1 Gbps.
+     */
+    void init(int bitrate_kbps, int link_rate_mbps) {
+      // Use around 80% of the link rate
+      max_kbps = (std::int64_t) (link_rate_mbps ? link_rate_mbps : 1000) * 1000 * 80 / 100;
+
+      // Never pace slower than twice the bitrate, which leaves room for FEC and
+      // for frames larger than average to finish well inside their frame interval
+      min_kbps = std::min<std::int64_t>(max_kbps, (std::int64_t) bitrate_kbps * 2);
+
+      rate_kbps = max_kbps;
+    }
+
+    /**
+     * @brief Adjust the budget from a loss report of the client.
+     * @param lost_packets The number of packets lost since the last report.
+     */
+    void on_loss_stats(int lost_packets) {
+      auto old_kbps = rate_kbps.load(std::memory_order_relaxed);
+
+      std::int64_t new_kbps;
+      if (lost_packets > 0) {
+        new_kbps = std::max(min_kbps, old_kbps * 3 / 4);
+      } else {
+        new_kbps = std::min(max_kbps, old_kbps + std::max<std::int64_t>((max_kbps - min_kbps) / 20, 1));
+      }
+
+      if (new_kbps != old_kbps) {
+        rate_kbps.store(new_kbps, std::memory_order_relaxed);
+        BOOST_LOG(verbose) << "Video pacing rate changed to "sv << new_kbps / 1000 << " Mbps ("sv << lost_packets << " packets lost)"sv;
+      }
+    }
+
+    /**
+     * @brief Get the number of packets that may be sent per millisecond.
+     * @param blocksize The size of each packet.
+     * @return The number of packets, at least 1.
+     */
+    std::size_t packets_in_1ms(std::size_t blocksize) const {
+      //                                                         kbps          bits   ms   byte
+      return std::max<std::size_t>(1, rate_kbps.load(std::memory_order_relaxed) * 1000 / 1000 / 8 / blocksize);
+    }
+
+  private:
+    std::atomic<std::int64_t> rate_kbps;
+    std::int64_t min_kbps;
+    std::int64_t max_kbps;
+  };
+
+  /**
+   * @brief Per-session controller choosing the amount of video FEC from the client's loss reports.
+   * @details The configured FEC percentage is the ceiling, which the bitrate budget of the
+   * session already accounts for. On clean links the percentage settles at the floor, and
+   * it rises with the smoothed loss ratio reported by the client.
+   */
+  class fec_controller_t {
+  public:
+    /**
+     * @brief Initialize the controller for a session.
+     * @param adaptive Whether to adapt to loss reports, or always use the maximum percentage.
+     * @param max_percentage The configured FEC percentage.
+     * @param min_parity_shards The minimum number of parity shards requested by the client.
+     */
+    void init(bool adaptive, int max_percentage, int min_parity_shards) {
+      this->adaptive = adaptive;
+      this->max_percentage = max_percentage;
+      this->min_percentage = std::min(max_percentage, 5);
+      client_min_parity_shards = min_parity_shards;
+      loss_ratio = 0;
+      packets_sent = 0;
+
+      current_percentage = adaptive ? min_percentage : max_percentage;
+      current_min_parity_shards = min_parity_shards;
+    }
+
+    /**
+     * @brief Account for video packets sent to the client.
+     * @param packets The number of data and parity packets sent.
+     */
+    void on_packets_sent(std::size_t packets) {
+      packets_sent.fetch_add(packets, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Adjust the FEC settings from a loss report of the client.
+     * @param lost_packets The number of packets lost since the last report.
+     */
+    void on_loss_stats(int lost_packets) {
+      auto sent = packets_sent.exchange(0, std::memory_order_relaxed);
+      if (!adaptive || sent + lost_packets == 0) {
+        return;
+      }
+
+      // React quickly to new losses, but only back off slowly once they stop
+      auto ratio = (double) lost_packets / (sent + lost_packets);
+      auto weight = ratio > loss_ratio ? 0.5 : 0.1;
+      loss_ratio = loss_ratio * (1 - weight) + ratio * weight;
+
+      // Send 4 times as much parity as the loss we're seeing to absorb bursts of loss
+      auto percentage = std::clamp(min_percentage + (int) std::ceil(loss_ratio * 400), min_percentage, max_percentage);
+
+      // Small frames only get a single parity shard from the percentage alone
+      auto min_parity_shards = loss_ratio >= 0.01 ? std::max(client_min_parity_shards, 2) : client_min_parity_shards;
+
+      if (percentage != current_percentage || min_parity_shards != current_min_parity_shards) {
+        BOOST_LOG(debug) << "Adaptive FEC: loss "sv << loss_ratio * 100 << "%, FEC percentage "sv << current_percentage << " -> "sv << percentage
+                         << ", minimum parity shards "sv << min_parity_shards;
+
+        current_percentage = percentage;
+        current_min_parity_shards = min_parity_shards;
+      }
+    }
+
+    /**
+     * @brief Get the FEC percentage to use for the next frame.
+     * @return The FEC percentage.
+     */
+    int percentage() const {
+      return current_percentage.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the minimum number of parity shards per FEC block for the next frame.
+     * @return The minimum number of parity shards.
+     */
+    int min_parity_shards() const {
+      return current_min_parity_shards.load(std::memory_order_relaxed);
+    }
+
+  private:
+    bool adaptive;
+    int min_percentage;
+    int max_percentage;
+    int client_min_parity_shards;
+    double loss_ratio;
+
+    std::atomic<std::size_t> packets_sent;
+    std::atomic<int> current_percentage;
+    std::atomic<int> current_min_parity_shards;
+  };
+
+  /**
+   * @brief Per-session accounting of the packets passing through a shared packet mailbox.
+   * @details Producers stamp every packet with a per-stream sequence number and the time it
+   * was queued. When the mailbox overflows, the broadcast thread sees a gap in the sequence.
+   */
+  class mailbox_stats_t {
+  public:
+    /**
+     * @param delay_message The log message for the time packets spent queued.
+     * @param depth_message The log message for the queue depth seen by the broadcast thread.
+     */
+    mailbox_stats_t(std::string_view delay_message, std::string_view depth_message):
+        queue_delay_logger(debug, delay_message, "ms"),
+        queue_depth_logger(debug, depth_message, " packets") {
+    }
+
+    /**
+     * @brief Account for a packet taken out of the mailbox.
+     * @param sequence The sequence number the producer assigned to the packet.
+     * @param queued_at The time the producer queued the packet.
+     * @param depth The number of packets still queued behind it.
+     * @return The number of packets of this stream dropped right before this one.
+     */
+    std::int64_t on_packet(std::int64_t sequence, std::chrono::steady_clock::time_point queued_at, std::size_t depth) {
+      queue_delay_logger.collect_and_log(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - queued_at).count());
+      queue_depth_logger.collect_and_log(depth);
+
+      // The sequence restarts when the producer is reinitialized, which isn't a drop
+      auto gap = next_sequence >= 0 && sequence > next_sequence ? sequence - next_sequence : 0;
+      next_sequence = sequence + 1;
+
+      dropped_packets.fetch_add(gap, std::memory_order_relaxed);
+      if (stream_stats) {
+        stream_stats->dropped.fetch_add(gap, std::memory_order_relaxed);
+        stream_stats->queue_depth.store(depth, std::memory_order_relaxed);
+      }
+
+      return gap;
+    }
+
+    /**
+     * @brief Also feed the live statistics of the stream.
+     * @param stream_stats The statistics, or nullptr to stop feeding them.
+     */
+    void record_into(stats::stream_stats_t *stream_stats) {
+      this->stream_stats = stream_stats;
+      queue_delay_logger.record_into(stream_stats ? &stream_stats->queue_delay : nullptr);
+    }
+
+    /**
+     * @brief Get the number of packets of this stream dropped by the mailbox so far.
+     * @return The number of dropped packets.
+     */
+    std::uint64_t dropped() const {
+      return dropped_packets.load(std::memory_order_relaxed);
+    }
+
+  private:
+    logging::percentile_periodic_logger<double> queue_delay_logger;
+    logging::percentile_periodic_logger<std::size_t> queue_depth_logger;
+
+    std::int64_t next_sequence = -1;
+    std::atomic<std::uint64_t> dropped_packets = 0;
+    stats::stream_stats_t *stream_stats = nullptr;
   };
 
   struct session_t {
@@ -350,6 +779,9 @@ namespace stream {
     std::thread audioThread;
     std::thread videoThread;
 
+    // Live statistics, reported by the stats API of the web UI
+    std::shared_ptr<stats::session_stats_t> stats;
+
     std::chrono::steady_clock::time_point pingTimeout;
 
     safe::shared_t<broadcast_ctx_t>::ptr_t broadcast_ref;
@@ -365,6 +797,18 @@ namespace stream {
       std::optional<crypto::cipher::gcm_t> cipher;
       std::uint64_t gcm_iv_counter;
 
+      fec::shard_arena_t shard_arena;
+
+      pacing_budget_t pacing;
+      fec_controller_t fec;
+      mailbox_stats_t mailbox {"Video mailbox: time in queue", "Video mailbox: queue depth"};
+
+      // Cipher contexts used to encrypt batches of shards in parallel
+      std::vector<crypto::cipher::gcm_t> batch_ciphers;
+
+      // Frames waiting for the video send thread of this session
+      std::shared_ptr<safe::queue_t<video::packet_t>> send_queue = std::make_shared<safe::queue_t<video::packet_t>>();
+
       safe::mail_raw_t::event_t<bool> idr_events;
       safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
 
@@ -385,6 +829,7 @@ namespace stream {
       util::buffer_t<uint8_t *> shards_p;
 
       audio_fec_packet_t fec_packet;
+      mailbox_stats_t mailbox {"Audio mailbox: time in queue", "Audio mailbox: queue depth"};
       std::unique_ptr<platf::deinit_t> qos;
     } audio;
 
@@ -561,16 +1006,32 @@ namespace stream {
   }
 
   void control_server_t::iterate(std::chrono::milliseconds timeout) {
-    ENetEvent event;
-    auto res = enet_host_service(_host.get(), &event, timeout.count());
+    // Send whatever was queued for the clients before going to sleep
+    enet_host_flush(_host.get());
+
+    auto wake_socket = (ENetSocket) _wake_sock.native_handle();
 
-    if (res > 0) {
+    ENetSocketSet read_set;
+    ENET_SOCKETSET_EMPTY(read_set);
+    ENET_SOCKETSET_ADD(read_set, _host->socket);
+    ENET_SOCKETSET_ADD(read_set, wake_socket);
+
+    if (enet_socketset_select(std::max(_host->socket, wake_socket), &read_set, nullptr, timeout.count()) > 0 &&
+        ENET_SOCKETSET_CHECK(read_set, wake_socket)) {
+      std::array<char, 64> buf;
+      boost::system::error_code ec;
+      while (_wake_sock.receive(asio::buffer(buf), 0, ec) > 0 && !ec) {}
+    }
+
+    // Also runs ENet's timers, so retransmissions and pings happen even without traffic
+    ENetEvent event;
+    while (enet_host_service(_host.get(), &event, 0) > 0) {
       auto session = get_session(event.peer, event.data);
       if (!session) {
         BOOST_LOG(warning) << "Rejected connection from ["sv << platf::from_sockaddr((sockaddr *) &event.peer->address.address) << "]: it's not properly set up"sv;
         enet_peer_disconnect_now(event.peer, 0);
 
-        return;
+        continue;
       }
 
       session->pingTimeout = std::chrono::steady_clock::now() + config::stream.ping_timeout;
@@ -602,115 +1063,47 @@ namespace stream {
     }
   }
 
-  namespace fec {
-    using rs_t = util::safe_ptr<reed_solomon, [](reed_solomon *rs) {
-      reed_solomon_release(rs);
-    }>;
-
-    struct fec_t {
-      size_t data_shards;
-      size_t nr_shards;
-      size_t percentage;
-
-      size_t blocksize;
-      size_t prefixsize;
-      util::buffer_t<char> shards;
-      util::buffer_t<char> headers;
-      util::buffer_t<uint8_t *> shards_p;
-
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
-
-      char *data(size_t el) {
-        return (char *) shards_p[el];
-      }
-
-      char *prefix(size_t el) {
-        return prefixsize ? &headers[el * prefixsize] : nullptr;
-      }
-
-      size_t size() const {
-        return nr_shards;
-      }
-    };
-
-    static fec_t encode(const std::string_view &payload, size_t blocksize, size_t fecpercentage, size_t minparityshards, size_t prefixsize) {
-      auto payload_size = payload.size();
-
-      auto pad = payload_size % blocksize != 0;
-
-      auto aligned_data_shards = payload_size / blocksize;
-      auto data_shards = aligned_data_shards + (pad ? 1 : 0);
-      auto parity_shards = (data_shards * fecpercentage + 99) / 100;
-
-      // increase the FEC percentage for this frame if the parity shard minimum is not met
-      if (parity_shards < minparityshards && fecpercentage != 0) {
-        parity_shards = minparityshards;
-        fecpercentage = (100 * parity_shards) / data_shards;
-
-        BOOST_LOG(verbose) << "Increasing FEC percentage to "sv << fecpercentage << " to meet parity shard minimum"sv << std::endl;
-      }
-
-      auto nr_shards = data_shards + parity_shards;
-
-      // If we need to store a zero-padded data shard, allocate that first to
-      // to keep the shards in order and reduce buffer fragmentation
-      auto parity_shard_offset = pad ? 1 : 0;
-      util::buffer_t<char> shards {(parity_shard_offset + parity_shards) * blocksize};
-      util::buffer_t<uint8_t *> shards_p {nr_shards};
-      std::vector<platf::buffer_descriptor_t> payload_buffers;
-      payload_buffers.reserve(2);
-
-      // Point into the payload buffer for all except the final padded data shard
-      auto next = std::begin(payload);
-      for (auto x = 0; x < aligned_data_shards; ++x) {
-        shards_p[x] = (uint8_t *) next;
-        next += blocksize;
-      }
-      payload_buffers.emplace_back(std::begin(payload), aligned_data_shards * blocksize);
-
-      // If the last data shard needs to be zero-padded, we must use the shards buffer
-      if (pad) {
-        shards_p[aligned_data_shards] = (uint8_t *) &shards[0];
-
-        // GCC doesn't figure out that std::copy_n() can be replaced with memcpy() here
-        // and ends up compiling a horribly slow element-by-element copy loop, so we
-        // help it by using memcpy()/memset() directly.
-        auto copy_len = std::min<size_t>(blocksize, std::end(payload) - next);
-        std::memcpy(shards_p[aligned_data_shards], next, copy_len);
-        if (copy_len < blocksize) {
-          // Zero any additional space after the end of the payload
-          std::memset(shards_p[aligned_data_shards] + copy_len, 0, blocksize - copy_len);
+  /**
+   * @brief Combines buffers into a destination buffer, leaving zeroed space at each slice boundary.
+   * @param insert_size The number of bytes to insert.
+   * @param slice_size The number of bytes between insertions.
+   * @param segments The data buffers to combine.
+   * @param destination The destination buffer, which must be large enough for the result.
+   * @return The number of bytes written to the destination buffer.
+   */
+  size_t concat_and_insert(uint64_t insert_size, uint64_t slice_size, std::span<const std::string_view> segments, char *destination) {
+    auto next_out = destination;
+    auto slice_left = slice_size;
+
+    for (const auto &segment : segments) {
+      auto next = segment.data();
+      auto left = segment.size();
+
+      while (left) {
+        // Make room for the inserted buffer at the start of each slice
+        if (slice_left == slice_size) {
+          std::memset(next_out, 0, insert_size);
+          next_out += insert_size;
         }
-      }
 
-      // Add a payload buffer describing the shard buffer
-      payload_buffers.emplace_back(std::begin(shards), shards.size());
+        // GCC doesn't figure out that std::copy_n() can be replaced with memcpy() here,
+        // so we help it by using memcpy() directly.
+        auto copy_len = std::min<size_t>(left, slice_left);
+        std::memcpy(next_out, next, copy_len);
 
-      if (fecpercentage != 0) {
-        // Point into our allocated buffer for the parity shards
-        for (auto x = 0; x < parity_shards; ++x) {
-          shards_p[data_shards + x] = (uint8_t *) &shards[(parity_shard_offset + x) * blocksize];
-        }
-
-        // packets = parity_shards + data_shards
-        rs_t rs {reed_solomon_new(data_shards, parity_shards)};
+        next_out += copy_len;
+        next += copy_len;
+        left -= copy_len;
 
-        reed_solomon_encode(rs.get(), shards_p.begin(), nr_shards, blocksize);
+        slice_left -= copy_len;
+        if (slice_left == 0) {
+          slice_left = slice_size;
+        }
       }
-
-      return {
-        data_shards,
-        nr_shards,
-        fecpercentage,
-        blocksize,
-        prefixsize,
-        std::move(shards),
-        util::buffer_t<char> {nr_shards * prefixsize},
-        std::move(shards_p),
-        std::move(payload_buffers),
-      };
     }
-  }  // namespace fec
+
+    return next_out - destination;
+  }
 
   /**
    * @brief Combines two buffers and inserts new buffers at each slice boundary of the result.
@@ -727,51 +1120,74 @@ namespace stream {
     std::vector<uint8_t> result;
     result.resize(elements * insert_size + data_size);
 
-    auto next = std::begin(data1);
-    auto end = std::end(data1);
-    for (auto x = 0; x < elements; ++x) {
-      void *p = &result[x * (insert_size + slice_size)];
+    std::array<std::string_view, 2> segments {data1, data2};
+    concat_and_insert(insert_size, slice_size, segments, (char *) result.data());
 
-      // For the last iteration, only copy to the end of the data
-      if (x == elements - 1) {
-        slice_size = data_size - (x * slice_size);
+    return result;
+  }
+
+  /**
+   * @brief Finds the first match of a pattern in the payload made up of the segments.
+   * @param segments The buffers making up the payload.
+   * @param pattern The bytes to look for.
+   * @return The segment and the offset within it where the match starts, or the number of segments if there is no match.
+   */
+  static std::pair<size_t, size_t> find_in_segments(const std::vector<std::string_view> &segments, const std::string_view &pattern) {
+    // A match may straddle segment boundaries, so the last bytes of each segment are
+    // searched again together with the first bytes of the segments following it
+    std::string window;
+
+    for (size_t x = 0; x < segments.size(); ++x) {
+      auto segment = segments[x];
+      auto offset = segment.find(pattern);
+      if (offset != std::string_view::npos) {
+        return {x, offset};
       }
 
-      // Test if this slice will extend into the next buffer
-      if (next + slice_size > end) {
-        // Copy the first portion from the first buffer
-        auto copy_len = end - next;
-        std::copy(next, end, (char *) p + insert_size);
+      auto overlap = pattern.size() - 1;
+      auto tail = std::min(segment.size(), overlap);
+      window.assign(segment.substr(segment.size() - tail));
+      for (auto y = x + 1; y < segments.size() && window.size() < tail + overlap; ++y) {
+        window.append(segments[y].substr(0, tail + overlap - window.size()));
+      }
 
-        // Copy the remaining portion from the second buffer
-        next = std::begin(data2);
-        end = std::end(data2);
-        std::copy(next, next + (slice_size - copy_len), (char *) p + copy_len + insert_size);
-        next += slice_size - copy_len;
-      } else {
-        std::copy(next, next + slice_size, (char *) p + insert_size);
-        next += slice_size;
+      // Matches starting after the tail are found in the following segments
+      offset = window.find(pattern);
+      if (offset < tail) {
+        return {x, segment.size() - tail + offset};
       }
     }
 
-    return result;
+    return {segments.size(), 0};
   }
 
-  std::vector<uint8_t> replace(const std::string_view &original, const std::string_view &old, const std::string_view &_new) {
-    std::vector<uint8_t> replaced;
-    replaced.reserve(original.size() + _new.size() - old.size());
+  /**
+   * @brief Splits the buffers in segments at the first match of each replacement.
+   * @details This produces the replaced payload as a list of views into the original
+   * buffers, so it can be packetized without first building a copy of the frame.
+   * @param segments The buffers making up the payload.
+   * @param replacements The replacements to apply.
+   */
+  void apply_replacements(std::vector<std::string_view> &segments, const std::vector<video::packet_raw_t::replace_t> &replacements) {
+    for (auto &replacement : replacements) {
+      auto [index, offset] = find_in_segments(segments, replacement.old);
+      if (index == segments.size()) {
+        continue;
+      }
 
-    auto begin = std::begin(original);
-    auto end = std::end(original);
-    auto next = std::search(begin, end, std::begin(old), std::end(old));
+      // Trim whatever part of the match continues into the following segments
+      auto segment = segments[index];
+      auto matched = std::min(replacement.old.size(), segment.size() - offset);
+      for (auto left = replacement.old.size() - matched, x = index + 1; left > 0; ++x) {
+        auto trimmed = std::min(left, segments[x].size());
+        segments[x].remove_prefix(trimmed);
+        left -= trimmed;
+      }
 
-    std::copy(begin, next, std::back_inserter(replaced));
-    if (next != end) {
-      std::copy(std::begin(_new), std::end(_new), std::back_inserter(replaced));
-      std::copy(next + old.size(), end, std::back_inserter(replaced));
+      segments[index] = segment.substr(0, offset);
+      auto it = segments.insert(std::begin(segments) + index + 1, replacement._new);
+      segments.insert(it + 1, segment.substr(offset + matched));
     }
-
-    return replaced;
   }
 
   /**
@@ -914,6 +1330,16 @@ namespace stream {
     return 0;
   }
 
+  /**
+   * @brief Stop waking up the control thread for the events of a session.
+   * @param session The session leaving the control stream.
+   */
+  static void clear_control_notifiers(session_t &session) {
+    session.control.feedback_queue->on_raise(nullptr);
+    session.control.hdr_queue->on_raise(nullptr);
+    session.shutdown_event->on_raise(nullptr);
+  }
+
   void controlBroadcastThread(control_server_t *server) {
     server->map(packetTypes[IDX_PERIODIC_PING], [](session_t *session, const std::string_view &payload) {
       BOOST_LOG(verbose) << "type [IDX_PERIODIC_PING]"sv;
@@ -941,6 +1367,9 @@ namespace stream {
         << "time in milli since last report [" << t.count() << ']' << std::endl
         << "last good frame [" << lastGoodFrame << ']' << std::endl
         << "---end stats---";
+
+      session->video.pacing.on_loss_stats(count);
+      session->video.fec.on_loss_stats(count);
     });
 
     server->map(packetTypes[IDX_REQUEST_IDR_FRAME], [&](session_t *session, const std::string_view &payload) {
@@ -1062,6 +1491,18 @@ namespace stream {
     // termination when we shut down.
     auto shutdown_event = mail::man->event<bool>(mail::shutdown);
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+
+    shutdown_event->on_raise([server]() {
+      server->wake();
+    });
+    broadcast_shutdown_event->on_raise([server]() {
+      server->wake();
+    });
+    auto clear_notifiers = util::fail_guard([&]() {
+      shutdown_event->on_raise(nullptr);
+      broadcast_shutdown_event->on_raise(nullptr);
+    });
+
     while (!shutdown_event->peek() && !broadcast_shutdown_event->peek()) {
       bool has_session_awaiting_peer = false;
 
@@ -1086,6 +1527,7 @@ namespace stream {
 
           if (session->state.load(std::memory_order_acquire) == session::state_e::STOPPING) {
             pos = server->_sessions->erase(pos);
+            clear_control_notifiers(*session);
 
             if (session->control.peer) {
               {
@@ -1131,6 +1573,8 @@ namespace stream {
         break;
       }
 
+      // Messages queued for a client wake us up right away. The timeout only paces
+      // the ping timeout checks above and ENet's retransmission timers.
       server->iterate(150ms);
     }
 
@@ -1160,6 +1604,7 @@ namespace stream {
         }
       }
 
+      clear_control_notifiers(*session);
       session->shutdown_event->raise(true);
       session->controlEnd.raise(true);
     }
@@ -1167,156 +1612,268 @@ namespace stream {
     server->flush();
   }
 
-  void recvThread(broadcast_ctx_t &ctx) {
-    std::map<av_session_id_t, message_queue_t> peer_to_video_session;
-    std::map<av_session_id_t, message_queue_t> peer_to_audio_session;
+  // The ping payload sent to the client during the RTSP handshake, which it echoes in its pings
+  using ping_id_t = std::array<char, sizeof(SS_PING::payload)>;
+
+  struct ping_id_hash_t {
+    std::size_t operator()(const ping_id_t &id) const {
+      return std::hash<std::string_view> {}(std::string_view {id.data(), id.size()});
+    }
+  };
 
-    auto &video_sock = ctx.video_sock;
-    auto &audio_sock = ctx.audio_sock;
+  void recvThread(broadcast_ctx_t &ctx) {
+    // Indexed by socket_e
+    std::unordered_map<ping_id_t, message_queue_t, ping_id_hash_t> ping_to_session[2];
+    std::map<asio::ip::address, message_queue_t> address_to_session[2];
 
     auto &message_queue_queue = ctx.message_queue_queue;
     auto broadcast_shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
 
     auto &io = ctx.io_context;
 
-    udp::endpoint peer;
-
-    std::array<char, 2048> buf[2];
-    std::function<void(const boost::system::error_code, size_t)> recv_func[2];
-
     auto populate_peer_to_session = [&]() {
       while (message_queue_queue->peek()) {
         auto message_queue_opt = message_queue_queue->pop();
         TUPLE_3D_REF(socket_type, session_id, message_queue, *message_queue_opt);
 
-        switch (socket_type) {
-          case socket_e::video:
-            if (message_queue) {
-              peer_to_video_session.emplace(session_id, message_queue);
-            } else {
-              peer_to_video_session.erase(session_id);
-            }
-            break;
-          case socket_e::audio:
-            if (message_queue) {
-              peer_to_audio_session.emplace(session_id, message_queue);
-            } else {
-              peer_to_audio_session.erase(session_id);
-            }
-            break;
+        auto type = (int) socket_type;
+        if (auto address = std::get_if<asio::ip::address>(&session_id)) {
+          if (message_queue) {
+            address_to_session[type].emplace(*address, message_queue);
+          } else {
+            address_to_session[type].erase(*address);
+          }
+
+          continue;
+        }
+
+        auto &payload = std::get<std::string>(session_id);
+
+        ping_id_t ping_id {};
+        std::copy_n(payload.data(), std::min(payload.size(), ping_id.size()), std::begin(ping_id));
+        if (message_queue) {
+          ping_to_session[type].emplace(ping_id, message_queue);
+        } else {
+          ping_to_session[type].erase(ping_id);
         }
       }
     };
 
-    auto recv_func_init = [&](udp::socket &sock, int buf_elem, std::map<av_session_id_t, message_queue_t> &peer_to_session) {
-      recv_func[buf_elem] = [&, buf_elem](const boost::system::error_code &ec, size_t bytes) {
-        auto fg = util::fail_guard([&]() {
-          sock.async_receive_from(asio::buffer(buf[buf_elem]), peer, 0, recv_func[buf_elem]);
-        });
+    // Only pings during session setup have a session waiting for them, so nothing is allocated for the rest
+    auto handle_datagram = [&](int type, const udp::endpoint &peer, std::string_view datagram) {
+      auto type_str = type ? "AUDIO"sv : "VIDEO"sv;
+      BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+
+      message_queue_t message_queue;
+      if (datagram.size() == 4) {
+        // For legacy PING packets, find the matching session by address.
+        auto it = address_to_session[type].find(peer.address());
+        if (it != std::end(address_to_session[type])) {
+          message_queue = it->second;
+        }
+      } else if (datagram.size() >= sizeof(SS_PING)) {
+        // For new PING packets that include a client identifier, search by payload.
+        ping_id_t ping_id;
+        std::copy_n(((PSS_PING) datagram.data())->payload, ping_id.size(), std::begin(ping_id));
+
+        auto it = ping_to_session[type].find(ping_id);
+        if (it != std::end(ping_to_session[type])) {
+          message_queue = it->second;
+        }
+      }
 
-        auto type_str = buf_elem ? "AUDIO"sv : "VIDEO"sv;
-        BOOST_LOG(verbose) << "Recv: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+      if (message_queue) {
+        BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
+        message_queue->raise(peer, std::string {datagram});
+      }
+    };
 
-        populate_peer_to_session();
+    constexpr std::size_t recv_batch_size = 16;
 
-        // No data, yet no error
-        if (ec == boost::system::errc::connection_refused || ec == boost::system::errc::connection_reset) {
+    struct ingress_t {
+      std::array<std::array<char, 2048>, recv_batch_size> buffers;
+      std::array<udp::endpoint, recv_batch_size> peers;
+      std::array<platf::recv_datagram_t, recv_batch_size> datagrams;
+
+      std::function<void(const boost::system::error_code &)> on_readable;
+    };
+
+    std::array<ingress_t, 2> ingress;
+    std::array<udp::socket *, 2> sockets {&ctx.video_sock, &ctx.audio_sock};
+
+    for (int type = 0; type < 2; ++type) {
+      auto &in = ingress[type];
+      auto &sock = *sockets[type];
+
+      for (std::size_t x = 0; x < recv_batch_size; ++x) {
+        in.datagrams[x] = {
+          in.buffers[x].data(),
+          in.buffers[x].size(),
+          (sockaddr *) in.peers[x].data(),
+          in.peers[x].capacity(),
+        };
+      }
+
+      in.on_readable = [&, type](const boost::system::error_code &ec) {
+        auto &in = ingress[type];
+        auto &sock = *sockets[type];
+
+        // The wait is only aborted when the socket is closed, anything else must keep us reading
+        if (ec == asio::error::operation_aborted) {
           return;
         }
 
-        if (ec || !bytes) {
-          BOOST_LOG(error) << "Couldn't receive data from udp socket: "sv << ec.message();
+        auto fg = util::fail_guard([&]() {
+          sock.async_wait(udp::socket::wait_read, in.on_readable);
+        });
+
+        // Errors such as an ICMP port unreachable from a client are transient
+        if (ec) {
+          if (ec != boost::system::errc::connection_refused && ec != boost::system::errc::connection_reset) {
+            BOOST_LOG(error) << "Couldn't wait for data on udp socket: "sv << ec.message();
+          }
+
           return;
         }
 
-        if (bytes == 4) {
-          // For legacy PING packets, find the matching session by address.
-          auto it = peer_to_session.find(peer.address());
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+        populate_peer_to_session();
+
+        // Read everything that's waiting, a burst at a time
+        int received;
+        do {
+          received = platf::recv_batch(sock.native_handle(), in.datagrams);
+          if (received < 0) {
+            boost::system::error_code recv_ec;
+            auto bytes = sock.receive_from(asio::buffer(in.buffers[0]), in.peers[0], 0, recv_ec);
+
+            // No data, yet no error
+            if (recv_ec == boost::system::errc::connection_refused || recv_ec == boost::system::errc::connection_reset) {
+              return;
+            }
+
+            if (recv_ec || !bytes) {
+              BOOST_LOG(error) << "Couldn't receive data from udp socket: "sv << recv_ec.message();
+              return;
+            }
+
+            handle_datagram(type, in.peers[0], std::string_view {in.buffers[0].data(), bytes});
+            return;
           }
-        } else if (bytes >= sizeof(SS_PING)) {
-          auto ping = (PSS_PING) buf[buf_elem].data();
-
-          // For new PING packets that include a client identifier, search by payload.
-          auto it = peer_to_session.find(std::string {ping->payload, sizeof(ping->payload)});
-          if (it != std::end(peer_to_session)) {
-            BOOST_LOG(debug) << "RAISE: "sv << peer.address().to_string() << ':' << peer.port() << " :: " << type_str;
-            it->second->raise(peer, std::string {buf[buf_elem].data(), bytes});
+
+          for (int x = 0; x < received; ++x) {
+            auto &datagram = in.datagrams[x];
+            in.peers[x].resize(datagram.peer_bytes);
+
+            handle_datagram(type, in.peers[x], std::string_view {datagram.buffer, datagram.bytes});
           }
-        }
+        } while (received == (int) recv_batch_size);
       };
-    };
 
-    recv_func_init(video_sock, 0, peer_to_video_session);
-    recv_func_init(audio_sock, 1, peer_to_audio_session);
-
-    video_sock.async_receive_from(asio::buffer(buf[0]), peer, 0, recv_func[0]);
-    audio_sock.async_receive_from(asio::buffer(buf[1]), peer, 0, recv_func[1]);
+      sock.async_wait(udp::socket::wait_read, in.on_readable);
+    }
 
     while (!broadcast_shutdown_event->peek()) {
       io.run();
     }
   }
 
-  void videoBroadcastThread(udp::socket &sock) {
-    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
-    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
+  /**
+   * @brief Send the video frames of a single session.
+   * @details Every session has its own send thread, queue and pacing state,
+   * so pacing out the frames of one client never delays the frames of another.
+   * @param session The session.
+   * @param sock The video socket.
+   * @param kernel_pacing Whether the kernel paces out the batches.
+   * @param packetize_pool The workers of this session preparing FEC blocks and encrypting shards, if enabled.
+   */
+  void videoSendThread(session_t *session, udp::socket &sock, bool kernel_pacing, thread_pool_util::ThreadPool *packetize_pool) {
+    auto &packets = session->video.send_queue;
     auto video_epoch = std::chrono::steady_clock::now();
 
     // Video traffic is sent on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
 
-    logging::min_max_avg_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms");
+    logging::percentile_periodic_logger<double> frame_processing_latency_logger(debug, "Frame processing latency", "ms");
 
     logging::time_delta_periodic_logger frame_send_batch_latency_logger(debug, "Network: each send_batch() latency");
     logging::time_delta_periodic_logger frame_fec_latency_logger(debug, "Network: each FEC block latency");
     logging::time_delta_periodic_logger frame_network_latency_logger(debug, "Network: frame's overall network latency");
+    logging::percentile_periodic_logger<double> frame_send_duration_logger(debug, "Network: frame send duration", "ms");
+    logging::percentile_periodic_logger<double> frame_send_interval_logger(debug, "Network: frame send duration relative to frame interval", "%");
+
+    auto &session_stats = *session->stats;
+    frame_processing_latency_logger.record_into(&session_stats.frame_processing_latency);
+    frame_send_batch_latency_logger.record_into(&session_stats.send_batch_latency);
+    frame_fec_latency_logger.record_into(&session_stats.fec_latency);
+    frame_network_latency_logger.record_into(&session_stats.network_latency);
 
     crypto::aes_t iv(12);
 
     auto timer = platf::create_high_precision_timer();
     if (!timer || !*timer) {
-      BOOST_LOG(error) << "Failed to create timer, aborting video broadcast thread";
+      BOOST_LOG(error) << "Failed to create timer, aborting video send thread";
       return;
     }
 
+    // Only this thread paces, so only it runs with real-time scheduling, until the session ends
+    std::unique_ptr<platf::deinit_t> realtime_scheduling;
+    if (config::stream.pacing_realtime) {
+      realtime_scheduling = platf::enable_realtime_scheduling();
+    }
+
     auto ratecontrol_next_frame_start = std::chrono::steady_clock::now();
 
-    while (auto packet = packets->pop()) {
-      if (shutdown_event->peek()) {
-        break;
-      }
+    std::vector<std::future<void>> batch_futures;
 
+    while (auto packet = packets->pop()) {
       frame_network_latency_logger.first_point_now();
 
-      auto session = (session_t *) packet->channel_data;
+      trace::record("send_queue", packet->queued_at, std::chrono::steady_clock::now(), packet->frame_index(), session);
+      trace::span_t frame_span {"send_frame", packet->frame_index(), session};
+
       auto lowseq = session->video.lowseq;
 
-      std::string_view payload {(char *) packet->data(), packet->data_size()};
-      std::vector<uint8_t> payload_with_replacements;
+      // The client can't decode anything referencing the frames we lost. Ask for a new
+      // IDR frame right away, rather than letting the client notice the gap and ask later.
+      auto dropped_frames = session->video.mailbox.on_packet(packet->frame_index(), packet->queued_at, packets->size());
+      if (dropped_frames > 0 && !packet->is_idr()) {
+        BOOST_LOG(warning) << "Video packet queue overflowed, dropped "sv << dropped_frames << " frame(s) before frame "sv << packet->frame_index();
+        session->video.idr_events->raise(true);
+      }
+
+      auto &arena = session->video.shard_arena;
+      auto &segments = arena.segments;
+
+      // The first segment is reserved for the frame header, which we can't build until
+      // we know the final frame size.
+      segments.clear();
+      segments.emplace_back();
+      segments.emplace_back((char *) packet->data(), packet->data_size());
 
       // Apply replacements on the packet payload before performing any other operations.
       // We need to know the final frame size to calculate the last packet size, and we
       // must avoid matching replacements against the frame header or any other non-video
       // part of the payload.
       if (packet->is_idr() && packet->replacements) {
-        for (auto &replacement : *packet->replacements) {
-          auto frame_old = replacement.old;
-          auto frame_new = replacement._new;
+        apply_replacements(segments, *packet->replacements);
+      }
 
-          payload_with_replacements = replace(payload, frame_old, frame_new);
-          payload = {(char *) payload_with_replacements.data(), payload_with_replacements.size()};
-        }
+      size_t payload_size = 0;
+      for (const auto &segment : segments) {
+        payload_size += segment.size();
       }
 
+      // Frames can't be sent slice by slice as the encoder finishes them. The first packet
+      // carries the length of the last one, and every packet carries the shard count of its
+      // FEC block and the number of FEC blocks in the frame, so the whole frame must be known
+      // before its first packet goes out. Pipelining starts at the FEC blocks of a complete
+      // frame instead (see packetize_threads).
       video_short_frame_header_t frame_header = {};
       frame_header.headerType = 0x01;  // Short header type
       frame_header.frameType = packet->is_idr()                     ? 2 :
                                packet->after_ref_frame_invalidation ? 5 :
                                                                       1;
-      frame_header.lastPayloadLen = (payload.size() + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
+      frame_header.lastPayloadLen = (payload_size + sizeof(frame_header)) % (session->config.packetsize - sizeof(NV_VIDEO_PACKET));
       if (frame_header.lastPayloadLen == 0) {
         frame_header.lastPayloadLen = session->config.packetsize - sizeof(NV_VIDEO_PACKET);
       }
@@ -1334,17 +1891,18 @@ namespace stream {
         frame_header.frame_processing_latency = 0;
       }
 
-      auto fecPercentage = config::stream.fec_percentage;
+      segments.front() = std::string_view {(char *) &frame_header, sizeof(frame_header)};
+      payload_size += sizeof(frame_header);
 
-      // Insert space for packet headers
+      auto fecPercentage = session->video.fec.percentage();
+      auto minRequiredFecPackets = session->video.fec.min_parity_shards();
+
+      // Each data shard has space for the packet headers before the payload.
+      // The final data shard is zero-padded to the full block size.
       auto blocksize = session->config.packetsize + MAX_RTP_HEADER_SIZE;
       auto payload_blocksize = blocksize - sizeof(video_packet_raw_t);
-      auto payload_new = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, std::string_view {(char *) &frame_header, sizeof(frame_header)}, payload);
-
-      payload = std::string_view {(char *) payload_new.data(), payload_new.size()};
-
-      // There are 2 bits for FEC block count for a maximum of 4 FEC blocks
-      constexpr auto MAX_FEC_BLOCKS = 4;
+      auto data_shards = (payload_size + (payload_blocksize - 1)) / payload_blocksize;
+      auto frame_size = data_shards * blocksize;
 
       // The max number of data shards per block is found by solving this system of equations for D:
       // D = 255 - P
@@ -1357,7 +1915,7 @@ namespace stream {
 
       // Compute the number of FEC blocks needed for this frame using the block size and max shards
       auto max_data_per_fec_block = max_data_shards_per_fec_block * blocksize;
-      auto fec_blocks_needed = (payload.size() + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
+      auto fec_blocks_needed = (frame_size + (max_data_per_fec_block - 1)) / max_data_per_fec_block;
 
       // If the number of FEC blocks needed exceeds the protocol limit, turn off FEC for this frame.
       // For normal FEC percentages, this should only happen for enormous frames (over 800 packets at 20%).
@@ -1375,7 +1933,7 @@ namespace stream {
       BOOST_LOG(verbose) << "Generating "sv << fec_blocks_needed << " FEC blocks"sv;
 
       // Align individual FEC blocks to blocksize
-      auto unaligned_size = payload.size() / fec_blocks_needed;
+      auto unaligned_size = frame_size / fec_blocks_needed;
       auto aligned_size = ((unaligned_size + (blocksize - 1)) / blocksize) * blocksize;
 
       // If we exceed the 10-bit FEC packet index (which means our frame exceeded 4096 packets),
@@ -1384,6 +1942,26 @@ namespace stream {
         BOOST_LOG(error) << "Encoder produced a frame too large to send! Is the encoder broken? (needed "sv << (aligned_size / blocksize) << " packets)"sv;
       }
 
+      // Count the parity shards of each block, so the whole frame fits in the arena
+      std::array<size_t, MAX_FEC_BLOCKS> block_parity_shards {};
+      size_t parity_shards = 0;
+      for (int x = 0; x < fec_blocks_needed; ++x) {
+        auto block_size = x == fec_blocks_needed - 1 ? frame_size - x * aligned_size : aligned_size;
+        auto block_percentage = (size_t) fecPercentage;
+        block_parity_shards[x] = fec::parity_shards_for(block_size / blocksize, block_percentage, minRequiredFecPackets);
+        parity_shards += block_parity_shards[x];
+      }
+
+      // If video encryption is enabled, we allocate space for the encryption header before each shard
+      auto prefixsize = session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0;
+      arena.reserve(data_shards + parity_shards, blocksize, prefixsize);
+
+      // Insert space for packet headers while copying the frame into the arena
+      auto bytes = concat_and_insert(sizeof(video_packet_raw_t), payload_blocksize, segments, arena.shards.begin());
+      std::memset(arena.shards.begin() + bytes, 0, frame_size - bytes);
+
+      std::string_view payload {arena.shards.begin(), frame_size};
+
       // Split the data into aligned FEC blocks
       for (int x = 0; x < fec_blocks_needed; ++x) {
         if (x == fec_blocks_needed - 1) {
@@ -1395,9 +1973,144 @@ namespace stream {
         }
       }
 
+      // Shards are numbered consecutively across the blocks of the frame, and the parity
+      // shards of every block are stored in the arena after the data shards of the frame.
+      // Knowing where each block lives up front allows the blocks to be prepared independently.
+      std::array<size_t, MAX_FEC_BLOCKS> block_first_shard {};
+      std::array<char *, MAX_FEC_BLOCKS> block_parity {};
+      for (int x = 0, first_shard = 0; x < fec_blocks_needed; ++x) {
+        block_first_shard[x] = first_shard;
+        block_parity[x] = x == 0 ? arena.shards.begin() + frame_size : block_parity[x - 1] + block_parity_shards[x - 1] * blocksize;
+        first_shard += fec_blocks[x].size() / blocksize + block_parity_shards[x];
+      }
+      auto nr_shards = data_shards + parity_shards;
+
+      // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
+      // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
+      bool frame_is_dupe = false;
+      if (!packet->frame_timestamp) {
+        packet->frame_timestamp = ratecontrol_next_frame_start;
+        frame_is_dupe = true;
+      }
+      using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
+      uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
+
+      // Fill in the data shard headers of a block and generate its parity shards
+      auto encode_block = [&](int blockIndex) {
+        trace::span_t span {"fec_encode", packet->frame_index(), session};
+
+        auto &current_payload = fec_blocks[blockIndex];
+        auto block_lowseq = lowseq + block_first_shard[blockIndex];
+        auto packets = current_payload.size() / blocksize;
+
+        for (int x = 0; x < packets; ++x) {
+          auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
+
+          inspect->packet.frameIndex = packet->frame_index();
+          inspect->packet.streamPacketIndex = ((uint32_t) block_lowseq + x) << 8;
+
+          // Match multiFecFlags with Moonlight
+          inspect->packet.multiFecFlags = 0x10;
+          inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+
+          inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
+          if (x == 0) {
+            inspect->packet.flags |= FLAG_SOF;
+          }
+          if (x == packets - 1) {
+            inspect->packet.flags |= FLAG_EOF;
+          }
+        }
+
+        auto first_shard = block_first_shard[blockIndex];
+        return fec::encode(
+          current_payload,
+          block_parity[blockIndex],
+          &arena.shards_p[first_shard],
+          arena.headers.begin() + first_shard * prefixsize,
+          arena.payload_buffers[blockIndex],
+          blocksize,
+          fecPercentage,
+          minRequiredFecPackets,
+          prefixsize
+        );
+      };
+
+      // Reserve the IVs of the whole frame up front, so they can never be reused
+      // even if sending the frame fails halfway through
+      auto gcm_iv_base = session->video.gcm_iv_counter;
+      if (session->video.cipher) {
+        session->video.gcm_iv_counter += nr_shards;
+      }
+
+      // Set the FEC info now that we know for sure what our percentage will be for this frame,
+      // and encrypt the shards [begin, end) of a block if video encryption is enabled
+      auto finalize_shards = [&](const fec::fec_t &shards, int blockIndex, size_t begin, size_t end, crypto::cipher::gcm_t *cipher, crypto::aes_t &iv) {
+        trace::span_t span {"finalize_shards", packet->frame_index(), session};
+
+        auto block_lowseq = lowseq + block_first_shard[blockIndex];
+
+        for (auto x = begin; x < end; ++x) {
+          auto *inspect = (video_packet_raw_t *) shards.data(x);
+
+          inspect->packet.fecInfo =
+            (x << 12 |
+             shards.data_shards << 22 |
+             shards.percentage << 4);
+
+          inspect->rtp.header = 0x80 | FLAG_EXTENSION;
+          inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(block_lowseq + x);
+          inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
+
+          inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+          inspect->packet.frameIndex = packet->frame_index();
+
+          // Encrypt this shard if video encryption is enabled
+          if (cipher) {
+            // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
+            // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
+            // high bytes is the "fixed" field. Because each client provides their own unique
+            // key, our values in the fixed field need only uniquely identify each independent
+            // use of the client's key with AES-GCM in our code.
+            //
+            // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
+            // to be sent to each client before the IV repeats.
+            std::uint64_t iv_counter = gcm_iv_base + block_first_shard[blockIndex] + x;
+            std::copy_n((uint8_t *) &iv_counter, sizeof(iv_counter), std::begin(iv));
+            iv[11] = 'V';  // Video stream
+
+            // Encrypt the target buffer in place. Shards are encrypted one at a time: OpenSSL's EVP
+            // interface has no multi-buffer AES-GCM, so a batch call could only repeat this per shard.
+            // Parallelism comes from packetize_threads instead, with one GCM context per send batch.
+            auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
+            prefix->frameNumber = packet->frame_index();
+            std::copy(std::begin(iv), std::end(iv), prefix->iv);
+            if (cipher->encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv) < 0) {
+              // Never send a shard that failed to encrypt, abort the whole frame instead
+              throw std::runtime_error("Couldn't encrypt video shard");
+            }
+          }
+        }
+      };
+
+      // Outstanding work on the packetize pool must never outlive this frame
+      std::array<std::shared_future<fec::fec_t>, MAX_FEC_BLOCKS> block_futures;
+      auto wait_for_packetize_pool = util::fail_guard([&]() {
+        for (auto &future : block_futures) {
+          if (future.valid()) {
+            future.wait();
+          }
+        }
+        for (auto &future : batch_futures) {
+          if (future.valid()) {
+            future.wait();
+          }
+        }
+        batch_futures.clear();
+      });
+
       try {
-        // Use around 80% of 1Gbps          1Gbps            percent    ms     packet      byte
-        size_t ratecontrol_packets_in_1ms = std::giga::num * 80 / 100 / 1000 / blocksize / 8;
+        size_t ratecontrol_packets_in_1ms = session->video.pacing.packets_in_1ms(blocksize);
 
         // Send less than 64K in a single batch.
         // On Windows, batches above 64K seem to bypass SO_SNDBUF regardless of its size,
@@ -1415,37 +2128,12 @@ namespace stream {
         size_t ratecontrol_frame_packets_sent = 0;
         size_t ratecontrol_group_packets_sent = 0;
 
-        auto blockIndex = 0;
-        std::for_each(fec_blocks_begin, fec_blocks_end, [&](std::string_view &current_payload) {
-          auto packets = (current_payload.size() + (blocksize - 1)) / blocksize;
-
-          for (int x = 0; x < packets; ++x) {
-            auto *inspect = (video_packet_raw_t *) &current_payload[x * blocksize];
-
-            inspect->packet.frameIndex = packet->frame_index();
-            inspect->packet.streamPacketIndex = ((uint32_t) lowseq + x) << 8;
-
-            // Match multiFecFlags with Moonlight
-            inspect->packet.multiFecFlags = 0x10;
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
+        auto peer_address = session->video.peer.address();
 
-            inspect->packet.flags = FLAG_CONTAINS_PIC_DATA;
-            if (x == 0) {
-              inspect->packet.flags |= FLAG_SOF;
-            }
-            if (x == packets - 1) {
-              inspect->packet.flags |= FLAG_EOF;
-            }
-          }
-
-          frame_fec_latency_logger.first_point_now();
-          // If video encryption is enabled, we allocate space for the encryption header before each shard
-          auto shards = fec::encode(current_payload, blocksize, fecPercentage, session->config.minRequiredFecPackets, session->video.cipher ? sizeof(video_packet_enc_prefix_t) : 0);
-          frame_fec_latency_logger.second_point_now_and_log();
-
-          auto peer_address = session->video.peer.address();
+        // Send a block batch by batch, calling prepare_shards() to make each batch ready first
+        auto send_block = [&](const fec::fec_t &shards, int blockIndex, auto &&prepare_shards) {
           auto batch_info = platf::batched_send_info_t {
-            shards.headers.begin(),
+            shards.headers,
             shards.prefixsize,
             shards.payload_buffers,
             shards.blocksize,
@@ -1457,104 +2145,64 @@ namespace stream {
             session->localAddress,
           };
 
-          size_t next_shard_to_send = 0;
+          for (size_t next_shard_to_send = 0; next_shard_to_send < shards.size(); next_shard_to_send += send_batch_size) {
+            size_t current_batch_size = std::min(send_batch_size, shards.size() - next_shard_to_send);
+            prepare_shards(next_shard_to_send, next_shard_to_send + current_batch_size);
 
-          // RTP video timestamps use a 90 KHz clock and the frame_timestamp from when the frame was captured
-          // When a timestamp isn't available (duplicate frames), the timestamp from rate control is used instead.
-          bool frame_is_dupe = false;
-          if (!packet->frame_timestamp) {
-            packet->frame_timestamp = ratecontrol_next_frame_start;
-            frame_is_dupe = true;
-          }
-          using rtp_tick = std::chrono::duration<uint32_t, std::ratio<1, 90000>>;
-          uint32_t timestamp = std::chrono::round<rtp_tick>(*packet->frame_timestamp - video_epoch).count();
-
-          // set FEC info now that we know for sure what our percentage will be for this frame
-          for (auto x = 0; x < shards.size(); ++x) {
-            auto *inspect = (video_packet_raw_t *) shards.data(x);
-
-            inspect->packet.fecInfo =
-              (x << 12 |
-               shards.data_shards << 22 |
-               shards.percentage << 4);
-
-            inspect->rtp.header = 0x80 | FLAG_EXTENSION;
-            inspect->rtp.sequenceNumber = util::endian::big<uint16_t>(lowseq + x);
-            inspect->rtp.timestamp = util::endian::big<uint32_t>(timestamp);
-
-            inspect->packet.multiFecBlocks = (blockIndex << 4) | ((fec_blocks_needed - 1) << 6);
-            inspect->packet.frameIndex = packet->frame_index();
-
-            // Encrypt this shard if video encryption is enabled
-            if (session->video.cipher) {
-              // We use the deterministic IV construction algorithm specified in NIST SP 800-38D
-              // Section 8.2.1. The sequence number is our "invocation" field and the 'V' in the
-              // high bytes is the "fixed" field. Because each client provides their own unique
-              // key, our values in the fixed field need only uniquely identify each independent
-              // use of the client's key with AES-GCM in our code.
-              //
-              // The IV counter is 64 bits long which allows for 2^64 encrypted video packets
-              // to be sent to each client before the IV repeats.
-              std::copy_n((uint8_t *) &session->video.gcm_iv_counter, sizeof(session->video.gcm_iv_counter), std::begin(iv));
-              iv[11] = 'V';  // Video stream
-              session->video.gcm_iv_counter++;
-
-              // Encrypt the target buffer in place
-              auto *prefix = (video_packet_enc_prefix_t *) shards.prefix(x);
-              prefix->frameNumber = packet->frame_index();
-              std::copy(std::begin(iv), std::end(iv), prefix->iv);
-              session->video.cipher->encrypt(std::string_view {(char *) inspect, (size_t) blocksize}, prefix->tag, (uint8_t *) inspect, &iv);
+            if (kernel_pacing) {
+              // Stamp each batch with the time it's due and let the kernel hold it back,
+              // so this thread never sleeps in the middle of a frame
+              batch_info.txtime = ratecontrol_frame_start +
+                                  std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                                    ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
             }
-
-            if (x - next_shard_to_send + 1 >= send_batch_size ||
-                x + 1 == shards.size()) {
-              // Do pacing within the frame.
-              // Also trigger pacing before the first send_batch() of the frame
-              // to account for the last send_batch() of the previous frame.
-              if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
-                  ratecontrol_frame_packets_sent == 0) {
-                auto due = ratecontrol_frame_start +
-                           std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
-                             ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
-
-                auto now = std::chrono::steady_clock::now();
-                if (now < due) {
-                  timer->sleep_for(due - now);
-                }
-
-                ratecontrol_group_packets_sent = 0;
+            // Do pacing within the frame.
+            // Also trigger pacing before the first send_batch() of the frame
+            // to account for the last send_batch() of the previous frame.
+            else if (ratecontrol_group_packets_sent >= ratecontrol_packets_in_1ms ||
+                     ratecontrol_frame_packets_sent == 0) {
+              auto due = ratecontrol_frame_start +
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(1ms) *
+                           ratecontrol_frame_packets_sent / ratecontrol_packets_in_1ms;
+
+              auto now = std::chrono::steady_clock::now();
+              if (now < due) {
+                trace::span_t span {"pacing_sleep", packet->frame_index(), session};
+                timer->sleep_for(due - now);
               }
 
-              size_t current_batch_size = x - next_shard_to_send + 1;
-              batch_info.block_offset = next_shard_to_send;
-              batch_info.block_count = current_batch_size;
-
-              frame_send_batch_latency_logger.first_point_now();
-              // Use a batched send if it's supported on this platform
-              if (!platf::send_batch(batch_info)) {
-                // Batched send is not available, so send each packet individually
-                BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
-                for (auto y = 0; y < current_batch_size; y++) {
-                  auto send_info = platf::send_info_t {
-                    shards.prefix(next_shard_to_send + y),
-                    shards.prefixsize,
-                    shards.data(next_shard_to_send + y),
-                    shards.blocksize,
-                    (uintptr_t) sock.native_handle(),
-                    peer_address,
-                    session->video.peer.port(),
-                    session->localAddress,
-                  };
-
-                  platf::send(send_info);
-                }
-              }
-              frame_send_batch_latency_logger.second_point_now_and_log();
+              ratecontrol_group_packets_sent = 0;
+            }
 
-              ratecontrol_group_packets_sent += current_batch_size;
-              ratecontrol_frame_packets_sent += current_batch_size;
-              next_shard_to_send = x + 1;
+            batch_info.block_offset = next_shard_to_send;
+            batch_info.block_count = current_batch_size;
+
+            frame_send_batch_latency_logger.first_point_now();
+            trace::span_t send_span {"send_batch", packet->frame_index(), session};
+            // Use a batched send if it's supported on this platform
+            if (!platf::send_batch(batch_info)) {
+              // Batched send is not available, so send each packet individually
+              BOOST_LOG(verbose) << "Falling back to unbatched send"sv;
+              for (auto y = 0; y < current_batch_size; y++) {
+                auto send_info = platf::send_info_t {
+                  shards.prefix(next_shard_to_send + y),
+                  shards.prefixsize,
+                  shards.data(next_shard_to_send + y),
+                  shards.blocksize,
+                  (uintptr_t) sock.native_handle(),
+                  peer_address,
+                  session->video.peer.port(),
+                  session->localAddress,
+                  batch_info.txtime,  // Keep kernel pacing when batching is unavailable
+                };
+
+                platf::send(send_info);
+              }
             }
+            frame_send_batch_latency_logger.second_point_now_and_log();
+
+            ratecontrol_group_packets_sent += current_batch_size;
+            ratecontrol_frame_packets_sent += current_batch_size;
           }
 
           // remember this in case the next frame comes immediately
@@ -1569,17 +2217,100 @@ namespace stream {
                              << (frame_is_dupe ? " Dupe" : "")
                              << (packet->is_idr() ? " Key" : "")
                              << (packet->after_ref_frame_invalidation ? " RFI" : "");
+        };
 
-          ++blockIndex;
-          lowseq += shards.size();
-        });
+        auto *cipher = session->video.cipher ? &*session->video.cipher : nullptr;
+        if (!packetize_pool) {
+          for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+            frame_fec_latency_logger.first_point_now();
+            auto shards = encode_block(blockIndex);
+            frame_fec_latency_logger.second_point_now_and_log();
+
+            send_block(shards, blockIndex, [&](size_t begin, size_t end) {
+              finalize_shards(shards, blockIndex, begin, end, cipher, iv);
+            });
+          }
+        } else {
+          // Each batch is encrypted on its own cipher context, as they aren't thread-safe
+          auto &batch_ciphers = session->video.batch_ciphers;
+          if (cipher) {
+            size_t nr_batches = 0;
+            for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+              auto block_nr_shards = fec_blocks[blockIndex].size() / blocksize + block_parity_shards[blockIndex];
+              nr_batches += (block_nr_shards + send_batch_size - 1) / send_batch_size;
+            }
+
+            while (batch_ciphers.size() < nr_batches) {
+              batch_ciphers.emplace_back(cipher->key, cipher->padding);
+            }
+          }
+
+          // Generate the parity shards of all blocks in parallel. The batches of each block
+          // are then finalized in parallel as soon as their block is ready. Tasks run in
+          // submission order, so a batch never waits on a block that hasn't started yet.
+          for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+            auto future = packetize_pool->push([&encode_block, blockIndex]() {
+              return encode_block(blockIndex);
+            });
+            block_futures[blockIndex] = future.share();
+          }
+
+          for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+            auto block_nr_shards = fec_blocks[blockIndex].size() / blocksize + block_parity_shards[blockIndex];
+            for (size_t begin = 0; begin < block_nr_shards; begin += send_batch_size) {
+              auto end = std::min(begin + send_batch_size, block_nr_shards);
+              auto *batch_cipher = cipher ? &batch_ciphers[batch_futures.size()] : nullptr;
 
-        session->video.lowseq = lowseq;
+              batch_futures.emplace_back(packetize_pool->push([&, blockIndex, begin, end, batch_cipher]() {
+                crypto::aes_t batch_iv(12);
+                finalize_shards(block_futures[blockIndex].get(), blockIndex, begin, end, batch_cipher, batch_iv);
+              }));
+            }
+          }
+
+          // Send each batch as soon as it is ready, while the following ones are still being prepared
+          auto next_batch = std::begin(batch_futures);
+          for (int blockIndex = 0; blockIndex < fec_blocks_needed; ++blockIndex) {
+            send_block(block_futures[blockIndex].get(), blockIndex, [&](size_t, size_t) {
+              (next_batch++)->get();
+            });
+          }
+        }
+
+        // Check whether frames are paced out within their frame interval. With kernel pacing,
+        // the last batch leaves when it is due rather than when send_batch() returns.
+        auto frame_send_end = std::max(std::chrono::steady_clock::now(), ratecontrol_next_frame_start);
+        auto frame_send_duration = std::chrono::duration<double, std::milli>(frame_send_end - ratecontrol_frame_start).count();
+        frame_send_duration_logger.collect_and_log(frame_send_duration);
+        frame_send_interval_logger.collect_and_log(frame_send_duration * session->config.monitor.framerate / 10.);
+
+        session->video.fec.on_packets_sent(nr_shards);
+        session->video.lowseq = lowseq + nr_shards;
+
+        session_stats.video.sent.fetch_add(1, std::memory_order_relaxed);
+        session_stats.video.bytes.fetch_add(nr_shards * (blocksize + prefixsize), std::memory_order_relaxed);
+        session_stats.fec_percentage.store(fecPercentage, std::memory_order_relaxed);
       } catch (const std::exception &e) {
         BOOST_LOG(error) << "Broadcast video failed "sv << e.what();
         std::this_thread::sleep_for(100ms);
       }
     }
+  }
+
+  void videoBroadcastThread() {
+    auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
+    auto packets = mail::man->queue<video::packet_t>(mail::video_packets);
+
+    // Hand every frame over to the send thread of its session
+    while (auto packet = packets->pop()) {
+      if (shutdown_event->peek()) {
+        break;
+      }
+
+      auto session = (session_t *) packet->channel_data;
+      trace::record("broadcast_queue", packet->queued_at, std::chrono::steady_clock::now(), packet->frame_index(), session);
+      session->video.send_queue->raise(std::move(*packet));
+    }
 
     shutdown_event->raise(true);
   }
@@ -1588,7 +2319,6 @@ namespace stream {
     auto shutdown_event = mail::man->event<bool>(mail::broadcast_shutdown);
     auto packets = mail::man->queue<audio::packet_t>(mail::audio_packets);
 
-    audio_packet_t audio_packet;
     fec::rs_t rs {reed_solomon_new(RTPA_DATA_SHARDS, RTPA_FEC_SHARDS)};
     crypto::aes_t iv(16);
 
@@ -1600,20 +2330,50 @@ namespace stream {
     const unsigned char parity[] = {0x77, 0x40, 0x38, 0x0e, 0xc7, 0xa7, 0x0d, 0x6c};
     memcpy(rs.get()->p, parity, sizeof(parity));
 
-    audio_packet.rtp.header = 0x80;
-    audio_packet.rtp.packetType = 97;
-    audio_packet.rtp.ssrc = 0;
+    // Packets that are queued together (e.g. one per session in the same audio tick)
+    // are sent together, data and parity alike, with a single call to platf::send_many().
+    // The headers and addresses referenced by the send_info_t entries live here until then.
+    struct batch_entry_t {
+      session_t *session;
+      audio_packet_t audio_packet;
+      std::array<audio_fec_packet_t, RTPA_FEC_SHARDS> fec_packets;
+      boost::asio::ip::address peer_address;
+    };
 
-    // Audio traffic is sent on this thread
-    platf::adjust_thread_priority(platf::thread_priority_e::high);
+    constexpr std::size_t max_batch_entries = 16;
+    std::array<batch_entry_t, max_batch_entries> batch;
+    std::size_t batch_entries = 0;
+    std::vector<platf::send_info_t> send_infos;
+    send_infos.reserve(max_batch_entries * (1 + RTPA_FEC_SHARDS));
 
-    while (auto packet = packets->pop()) {
-      if (shutdown_event->peek()) {
-        break;
+    auto send_batch = [&]() {
+      if (!send_infos.empty()) {
+        if (!platf::send_many(send_infos)) {
+          BOOST_LOG(verbose) << "Couldn't send all of "sv << send_infos.size() << " audio packet(s)"sv;
+        }
       }
 
-      TUPLE_2D_REF(channel_data, packet_data, *packet);
-      auto session = (session_t *) channel_data;
+      send_infos.clear();
+      batch_entries = 0;
+    };
+
+    // Encrypt and FEC-encode a single packet, appending its datagrams to the batch
+    auto add_to_batch = [&](audio::packet_t &packet) {
+      auto session = (session_t *) packet.channel_data;
+      auto &packet_data = packet.data;
+
+      // A second packet for the same session would reuse its shard buffers before they are sent
+      auto in_batch = std::any_of(std::begin(batch), std::begin(batch) + batch_entries, [session](const batch_entry_t &entry) {
+        return entry.session == session;
+      });
+      if (in_batch || batch_entries == max_batch_entries) {
+        send_batch();
+      }
+
+      auto dropped_packets = session->audio.mailbox.on_packet(packet.sequence, packet.queued_at, packets->size());
+      if (dropped_packets > 0) {
+        BOOST_LOG(warning) << "Audio packet queue overflowed, dropped "sv << dropped_packets << " packet(s)"sv;
+      }
 
       auto sequenceNumber = session->audio.sequenceNumber;
       auto timestamp = session->audio.timestamp;
@@ -1625,62 +2385,107 @@ namespace stream {
       auto bytes = encode_audio(session->config.encryptionFlagsEnabled & SS_ENC_AUDIO, packet_data, shards_p[sequenceNumber % RTPA_DATA_SHARDS], iv, session->audio.cipher);
       if (bytes < 0) {
         BOOST_LOG(error) << "Couldn't encode audio packet"sv;
-        break;
+        return false;
       }
 
+      // The payload has been copied into the shard, so the encoder may reuse its buffer
+      packet.recycle();
+
       BOOST_LOG(verbose) << "Audio [seq "sv << sequenceNumber << ", pts "sv << timestamp << "] ::  send..."sv;
 
+      auto &entry = batch[batch_entries++];
+      entry.session = session;
+      entry.peer_address = session->audio.peer.address();
+
+      auto &audio_packet = entry.audio_packet;
+      audio_packet.rtp.header = 0x80;
+      audio_packet.rtp.packetType = 97;
+      audio_packet.rtp.ssrc = 0;
       audio_packet.rtp.sequenceNumber = util::endian::big(sequenceNumber);
       audio_packet.rtp.timestamp = util::endian::big(timestamp);
 
       session->audio.sequenceNumber++;
       session->audio.timestamp += session->config.audio.packetDuration;
 
-      auto peer_address = session->audio.peer.address();
+      send_infos.push_back(platf::send_info_t {
+        (const char *) &audio_packet,
+        sizeof(audio_packet),
+        (const char *) shards_p[sequenceNumber % RTPA_DATA_SHARDS],
+        (size_t) bytes,
+        (uintptr_t) sock.native_handle(),
+        entry.peer_address,
+        session->audio.peer.port(),
+        session->localAddress,
+      });
+
+      auto &audio_stats = session->stats->audio;
+      audio_stats.sent.fetch_add(1, std::memory_order_relaxed);
+      audio_stats.bytes.fetch_add(sizeof(audio_packet) + bytes, std::memory_order_relaxed);
+
+      auto &fec_packet = session->audio.fec_packet;
+      // initialize the FEC header at the beginning of the FEC block
+      if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
+        fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
+        fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+      }
+
+      // generate parity shards at the end of the FEC block
+      if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
+        reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
+
+        for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
+          auto &shard_packet = entry.fec_packets[x];
+          shard_packet = fec_packet;
+          shard_packet.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
+          shard_packet.fecHeader.fecShardIndex = x;
+
+          send_infos.push_back(platf::send_info_t {
+            (const char *) &shard_packet,
+            sizeof(shard_packet),
+            (const char *) shards_p[RTPA_DATA_SHARDS + x],
+            (size_t) bytes,
+            (uintptr_t) sock.native_handle(),
+            entry.peer_address,
+            session->audio.peer.port(),
+            session->localAddress,
+          });
+          BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
+        }
+
+        audio_stats.bytes.fetch_add(RTPA_FEC_SHARDS * (sizeof(audio_fec_packet_t) + bytes), std::memory_order_relaxed);
+      }
+
+      return true;
+    };
+
+    // Audio traffic is sent on this thread
+    platf::adjust_thread_priority(platf::thread_priority_e::high);
+
+    while (auto packet = packets->pop()) {
+      if (shutdown_event->peek()) {
+        break;
+      }
+
       try {
-        auto send_info = platf::send_info_t {
-          (const char *) &audio_packet,
-          sizeof(audio_packet),
-          (const char *) shards_p[sequenceNumber % RTPA_DATA_SHARDS],
-          (size_t) bytes,
-          (uintptr_t) sock.native_handle(),
-          peer_address,
-          session->audio.peer.port(),
-          session->localAddress,
-        };
-        platf::send(send_info);
+        if (!add_to_batch(*packet)) {
+          break;
+        }
 
-        auto &fec_packet = session->audio.fec_packet;
-        // initialize the FEC header at the beginning of the FEC block
-        if (sequenceNumber % RTPA_DATA_SHARDS == 0) {
-          fec_packet.fecHeader.baseSequenceNumber = util::endian::big(sequenceNumber);
-          fec_packet.fecHeader.baseTimestamp = util::endian::big(timestamp);
+        // Pick up everything else that is already waiting, without blocking
+        bool encoded = true;
+        while (encoded && packets->peek()) {
+          auto next_packet = packets->pop();
+          encoded = next_packet && add_to_batch(*next_packet);
         }
 
-        // generate parity shards at the end of the FEC block
-        if ((sequenceNumber + 1) % RTPA_DATA_SHARDS == 0) {
-          reed_solomon_encode(rs.get(), shards_p.begin(), RTPA_TOTAL_SHARDS, bytes);
-
-          for (auto x = 0; x < RTPA_FEC_SHARDS; ++x) {
-            fec_packet.rtp.sequenceNumber = util::endian::big<std::uint16_t>(sequenceNumber + x + 1);
-            fec_packet.fecHeader.fecShardIndex = x;
-
-            auto send_info = platf::send_info_t {
-              (const char *) &fec_packet,
-              sizeof(fec_packet),
-              (const char *) shards_p[RTPA_DATA_SHARDS + x],
-              (size_t) bytes,
-              (uintptr_t) sock.native_handle(),
-              peer_address,
-              session->audio.peer.port(),
-              session->localAddress,
-            };
-            platf::send(send_info);
-            BOOST_LOG(verbose) << "Audio FEC ["sv << (sequenceNumber & ~(RTPA_DATA_SHARDS - 1)) << ' ' << x << "] ::  send..."sv;
-          }
+        send_batch();
+        if (!encoded) {
+          break;
         }
       } catch (const std::exception &e) {
         BOOST_LOG(error) << "Broadcast audio failed "sv << e.what();
+        send_infos.clear();
+        batch_entries = 0;
         std::this_thread::sleep_for(100ms);
       }
     }
@@ -1739,7 +2544,18 @@ namespace stream {
 
     ctx.message_queue_queue = std::make_shared<message_queue_queue_t::element_type>(30);
 
-    ctx.video_thread = std::thread {videoBroadcastThread, std::ref(ctx.video_sock)};
+    // Let the kernel pace video packets if requested, otherwise pace them in user space
+    ctx.kernel_pacing = false;
+    if (config::stream.kernel_pacing) {
+      ctx.kernel_pacing = platf::enable_kernel_pacing(ctx.video_sock.native_handle());
+      if (ctx.kernel_pacing) {
+        BOOST_LOG(info) << "Video packets are paced by the kernel"sv;
+      } else {
+        BOOST_LOG(warning) << "Kernel pacing is unavailable, falling back to pacing video packets in user space"sv;
+      }
+    }
+
+    ctx.video_thread = std::thread {videoBroadcastThread};
     ctx.audio_thread = std::thread {audioBroadcastThread, std::ref(ctx.audio_sock)};
     ctx.control_thread = std::thread {controlBroadcastThread, &ctx.control_server};
 
@@ -1852,6 +2668,20 @@ namespace stream {
     auto address = session->video.peer.address();
     session->video.qos = platf::enable_socket_qos(ref->video_sock.native_handle(), address, session->video.peer.port(), platf::qos_data_type_e::video, session->config.videoQosType != 0);
 
+    // Optionally prepare FEC blocks and encrypt shards on a pool of workers, so sending can begin
+    // before the whole frame has been processed. Each session has its own workers, since the
+    // finalizing tasks of a frame wait on its FEC blocks and would stall the frames of other sessions.
+    std::unique_ptr<thread_pool_util::ThreadPool> packetize_pool;
+    if (config::stream.packetize_threads > 0) {
+      packetize_pool = std::make_unique<thread_pool_util::ThreadPool>(config::stream.packetize_threads);
+    }
+
+    std::thread send_thread {videoSendThread, session, std::ref(ref->video_sock), ref->kernel_pacing, packetize_pool.get()};
+    auto join_send_thread = util::fail_guard([&]() {
+      session->video.send_queue->stop();
+      send_thread.join();
+    });
+
     BOOST_LOG(debug) << "Start capturing Video"sv;
     video::capture(session->mail, session->config.monitor, session);
   }
@@ -1916,6 +2746,11 @@ namespace stream {
       session.audioThread.join();
       BOOST_LOG(debug) << "Waiting for control to end..."sv;
       session.controlEnd.view();
+
+      if (session.video.mailbox.dropped() || session.audio.mailbox.dropped()) {
+        BOOST_LOG(info) << "Packet queue overflows dropped "sv << session.video.mailbox.dropped() << " video frame(s) and "sv
+                        << session.audio.mailbox.dropped() << " audio packet(s) during this session"sv;
+      }
       // Reset input on session stop to avoid stuck repeated keys
       BOOST_LOG(debug) << "Resetting Input..."sv;
       input::reset(session.input);
@@ -1939,6 +2774,8 @@ namespace stream {
         platf::streaming_will_stop();
       }
 
+      stats::remove_session(&session);
+
       BOOST_LOG(debug) << "Session ended"sv;
     }
 
@@ -1953,10 +2790,23 @@ namespace stream {
       session.control.expected_peer_address = addr_string;
       BOOST_LOG(debug) << "Expecting incoming session connections from "sv << addr_string;
 
+      session.stats = stats::add_session(&session, addr_string);
+      session.video.mailbox.record_into(&session.stats->video);
+      session.audio.mailbox.record_into(&session.stats->audio);
+
+      // Wake up the control thread as soon as there's a message for the client, or the session stops
+      auto &control_server = session.broadcast_ref->control_server;
+      auto wake_control_thread = [&control_server]() {
+        control_server.wake();
+      };
+      session.control.feedback_queue->on_raise(wake_control_thread);
+      session.control.hdr_queue->on_raise(wake_control_thread);
+      session.shutdown_event->on_raise(wake_control_thread);
+
       // Insert this session into the session list
       {
-        auto lg = session.broadcast_ref->control_server._sessions.lock();
-        session.broadcast_ref->control_server._sessions->push_back(&session);
+        auto lg = control_server._sessions.lock();
+        control_server._sessions->push_back(&session);
       }
 
       auto addr = boost::asio::ip::make_address(addr_string);
@@ -2007,6 +2857,8 @@ namespace stream {
       session->video.invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
       session->video.lowseq = 0;
       session->video.ping_payload = launch_session.av_ping_payload;
+      session->video.pacing.init(config.monitor.bitrate, config::stream.pacing_link_rate);
+      session->video.fec.init(config::stream.adaptive_fec, config::stream.fec_percentage, config.minRequiredFecPackets);
       if (config.encryptionFlagsEnabled & SS_ENC_VIDEO) {
         BOOST_LOG(info) << "Video encryption enabled"sv;
         session->video.cipher = crypto::cipher::gcm_t {
@@ -83,6 +83,16 @@ namespace thread_pool_util {
       }
     }
 
+    /**
+     * @brief Add threads to a running pool, without disturbing the tasks of the existing ones.
+     * @param threads The number of threads to add.
+     */
+    void grow(int threads) {
+      for (int x = 0; x < threads; ++x) {
+        _thread.emplace_back(&ThreadPool::_main, this);
+      }
+    }
+
     void stop() {
       std::lock_guard lg(_lock);
 
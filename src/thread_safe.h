@@ -11,6 +11,7 @@
 #include <functional>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <vector>
 
 // local includes
@@ -36,6 +37,20 @@ namespace safe {
       }
 
       _cv.notify_all();
+
+      if (_notify) {
+        _notify();
+      }
+    }
+
+    /**
+     * @brief Call a function after every raise(), for a consumer that also waits on other things.
+     * @param notify The function to call, or `nullptr` to stop calling it.
+     */
+    void on_raise(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+
+      _notify = std::move(notify);
     }
 
     // pop and view should not be used interchangeably
@@ -143,6 +158,7 @@ namespace safe {
   private:
     bool _continue {true};
     status_t _status {util::false_v<status_t>};
+    std::function<void()> _notify;
 
     std::condition_variable _cv;
     std::mutex _lock;
@@ -249,34 +265,87 @@ namespace safe {
     return std::make_shared<alarm_raw_t<T>>();
   }
 
+  /**
+   * @brief What a bounded queue does with an element raised while the queue is full.
+   */
+  enum class overflow_e : int {
+    drop_oldest,  ///< Discard the oldest queued element to make room
+    drop_newest,  ///< Discard the element being raised
+    block,  ///< Wait until the consumer makes room
+  };
+
+  /**
+   * @brief Bounded multi-producer queue backed by a ring buffer.
+   */
   template<class T>
   class queue_t {
   public:
     using status_t = util::optional_t<T>;
 
-    queue_t(std::uint32_t max_elements = 32):
-        _max_elements {max_elements} {
+    queue_t(std::uint32_t max_elements = 32, overflow_e overflow = overflow_e::drop_oldest):
+        _overflow {overflow},
+        _ring(max_elements) {
     }
 
+    /**
+     * @brief Queue an element, applying the overflow policy if the queue is full.
+     * @return `true` if the element was queued without dropping any element.
+     */
     template<class... Args>
-    void raise(Args &&...args) {
-      std::lock_guard ul {_lock};
+    bool raise(Args &&...args) {
+      std::unique_lock ul {_lock};
 
       if (!_continue) {
-        return;
+        return false;
       }
 
-      if (_queue.size() == _max_elements) {
-        _queue.clear();
+      bool dropped = false;
+      if (_size == _ring.size()) {
+        switch (_overflow) {
+          case overflow_e::drop_oldest:
+            _ring[_head].reset();
+            _head = (_head + 1) % _ring.size();
+            --_size;
+            dropped = true;
+            break;
+          case overflow_e::drop_newest:
+            return false;
+          case overflow_e::block:
+            _cv_space.wait(ul, [this]() {
+              return !_continue || _size < _ring.size();
+            });
+
+            if (!_continue) {
+              return false;
+            }
+            break;
+        }
       }
 
-      _queue.emplace_back(std::forward<Args>(args)...);
+      _ring[(_head + _size) % _ring.size()].emplace(std::forward<Args>(args)...);
+      ++_size;
 
       _cv.notify_all();
+
+      if (_notify) {
+        _notify();
+      }
+
+      return !dropped;
+    }
+
+    /**
+     * @brief Call a function after every raise(), for a consumer that also waits on other things.
+     * @param notify The function to call, or `nullptr` to stop calling it.
+     */
+    void on_raise(std::function<void()> notify) {
+      std::lock_guard lg {_lock};
+
+      _notify = std::move(notify);
     }
 
     bool peek() {
-      return _continue && !_queue.empty();
+      return _continue && _size != 0;
     }
 
     template<class Rep, class Period>
@@ -287,16 +356,13 @@ namespace safe {
         return util::false_v<status_t>;
       }
 
-      while (_queue.empty()) {
+      while (_size == 0) {
         if (!_continue || _cv.wait_for(ul, delay) == std::cv_status::timeout) {
           return util::false_v<status_t>;
         }
       }
 
-      auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
-
-      return val;
+      return _pop_front();
     }
 
     status_t pop() {
@@ -306,7 +372,7 @@ namespace safe {
         return util::false_v<status_t>;
       }
 
-      while (_queue.empty()) {
+      while (_size == 0) {
         _cv.wait(ul);
 
         if (!_continue) {
@@ -314,14 +380,23 @@ namespace safe {
         }
       }
 
-      auto val = std::move(_queue.front());
-      _queue.erase(std::begin(_queue));
-
-      return val;
+      return _pop_front();
     }
 
-    std::vector<T> &unsafe() {
-      return _queue;
+    /**
+     * @brief Remove all queued elements, typically to clean them up after stop().
+     * @return The elements in queue order.
+     */
+    std::vector<T> drain() {
+      std::lock_guard lg {_lock};
+
+      std::vector<T> elements;
+      elements.reserve(_size);
+      while (_size) {
+        elements.emplace_back(_pop_front());
+      }
+
+      return elements;
     }
 
     void stop() {
@@ -330,20 +405,159 @@ namespace safe {
       _continue = false;
 
       _cv.notify_all();
+      _cv_space.notify_all();
     }
 
     [[nodiscard]] bool running() const {
       return _continue;
     }
 
+    /**
+     * @brief Get the number of queued elements.
+     * @return The number of queued elements.
+     */
+    std::size_t size() {
+      std::lock_guard lg {_lock};
+
+      return _size;
+    }
+
   private:
+    T _pop_front() {
+      auto val = std::move(*_ring[_head]);
+      _ring[_head].reset();
+
+      _head = (_head + 1) % _ring.size();
+      --_size;
+
+      if (_overflow == overflow_e::block) {
+        _cv_space.notify_one();
+      }
+
+      return val;
+    }
+
     bool _continue {true};
-    std::uint32_t _max_elements;
+    overflow_e _overflow;
+    std::function<void()> _notify;
 
     std::mutex _lock;
     std::condition_variable _cv;
+    std::condition_variable _cv_space;
+
+    std::vector<std::optional<T>> _ring;
+    std::size_t _head {0};
+    std::size_t _size {0};
+  };
+
+  /**
+   * @brief Bounded lock-free queue for exactly one producer and one consumer thread.
+   * @details raise() and pop() never take a lock. Since the producer can't touch the consumer's
+   * end of the ring, a full queue can only drop the newest element or block the producer.
+   */
+  template<class T>
+  class spsc_queue_t {
+  public:
+    using status_t = util::optional_t<T>;
+
+    spsc_queue_t(std::uint32_t max_elements = 32, overflow_e overflow = overflow_e::drop_newest):
+        _block {overflow == overflow_e::block},
+        _ring(max_elements) {
+    }
+
+    /**
+     * @brief Queue an element, applying the overflow policy if the queue is full.
+     * @return `true` if the element was queued.
+     */
+    template<class... Args>
+    bool raise(Args &&...args) {
+      auto tail = _tail.load(std::memory_order_relaxed);
+
+      while (true) {
+        auto wakeups = _wakeups.load(std::memory_order_acquire);
+        if (!_continue.load(std::memory_order_relaxed)) {
+          return false;
+        }
+
+        if (tail - _head.load(std::memory_order_acquire) < _ring.size()) {
+          break;
+        }
+
+        if (!_block) {
+          return false;
+        }
+
+        _wakeups.wait(wakeups, std::memory_order_acquire);
+      }
+
+      _ring[tail % _ring.size()].emplace(std::forward<Args>(args)...);
+      _tail.store(tail + 1, std::memory_order_release);
+
+      _wake();
+
+      return true;
+    }
+
+    bool peek() {
+      return _continue.load(std::memory_order_relaxed) && _tail.load(std::memory_order_acquire) != _head.load(std::memory_order_relaxed);
+    }
+
+    status_t pop() {
+      auto head = _head.load(std::memory_order_relaxed);
+
+      while (true) {
+        auto wakeups = _wakeups.load(std::memory_order_acquire);
+        if (!_continue.load(std::memory_order_relaxed)) {
+          return util::false_v<status_t>;
+        }
+
+        if (_tail.load(std::memory_order_acquire) != head) {
+          break;
+        }
+
+        _wakeups.wait(wakeups, std::memory_order_acquire);
+      }
+
+      auto &slot = _ring[head % _ring.size()];
+      auto val = std::move(*slot);
+      slot.reset();
+
+      _head.store(head + 1, std::memory_order_release);
+
+      if (_block) {
+        _wake();
+      }
+
+      return val;
+    }
+
+    void stop() {
+      _continue.store(false, std::memory_order_relaxed);
+
+      _wake();
+    }
+
+    [[nodiscard]] bool running() const {
+      return _continue.load(std::memory_order_relaxed);
+    }
+
+  private:
+    void _wake() {
+      _wakeups.fetch_add(1, std::memory_order_release);
+      _wakeups.notify_all();
+    }
+
+    std::atomic_bool _continue {true};
+    bool _block;
+
+    std::vector<std::optional<T>> _ring;
+
+    // Producer and consumer positions, which only ever increase
+    alignas(64) std::atomic<std::uint64_t> _head {0};
+    alignas(64) std::atomic<std::uint64_t> _tail {0};
 
-    std::vector<T> _queue;
+    // Bumped whenever a waiting thread may be able to make progress
+    alignas(64) std::atomic<std::uint32_t> _wakeups {0};
   };
 
   template<class T>
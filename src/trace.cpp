@@ -0,0 +1,214 @@
+/**
+ * @file src/trace.cpp
+ * @brief Definitions for per-frame pipeline tracing.
+ */
+// standard includes
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// lib includes
+#include <nlohmann/json.hpp>
+
+// local includes
+#include "logging.h"
+#include "trace.h"
+
+using namespace std::literals;
+
+namespace trace {
+  /**
+   * @brief A slot of a ring buffer.
+   * @details The fields are relaxed atomics, so a reader racing with the writer only
+   * ever sees torn events rather than undefined behavior. Torn events are discarded.
+   */
+  struct slot_t {
+    std::atomic<const char *> name;
+    std::atomic_int64_t start_ns;
+    std::atomic_int64_t duration_ns;
+    std::atomic_int64_t frame;
+    std::atomic<const void *> session;
+  };
+
+  /**
+   * @brief The ring buffer of a thread.
+   * @details There is a single writer, the owning thread. Before writing a slot, it
+   * announces the write in `begun`. Once the slot is written, it publishes it in `written`.
+   * A reader copies the published slots, then discards those that `begun` shows may have
+   * been overwritten while copying.
+   */
+  struct buffer_t {
+    std::array<slot_t, events_per_thread> slots;
+    std::atomic_uint64_t begun {0};
+    std::atomic_uint64_t written {0};
+
+    // Buffers of threads that exited are handed to the next new thread
+    std::atomic_bool owned {true};
+  };
+
+  static std::atomic_bool tracing {false};
+
+  static std::mutex registry_lock;
+  static std::vector<std::shared_ptr<buffer_t>> registry;
+
+  /**
+   * @brief Hands the buffer of a thread back to the registry when the thread exits.
+   */
+  struct thread_buffer_t {
+    std::shared_ptr<buffer_t> buffer;
+
+    ~thread_buffer_t() {
+      if (buffer) {
+        buffer->owned.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  /**
+   * @brief Get the buffer of the calling thread, registering one if needed.
+   * @return The buffer of the calling thread.
+   */
+  static buffer_t &thread_buffer() {
+    thread_local thread_buffer_t local;
+    if (local.buffer) {
+      return *local.buffer;
+    }
+
+    std::lock_guard lg {registry_lock};
+    for (auto &buffer : registry) {
+      bool owned = false;
+      if (buffer->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+        local.buffer = buffer;
+        return *local.buffer;
+      }
+    }
+
+    local.buffer = registry.emplace_back(std::make_shared<buffer_t>());
+    return *local.buffer;
+  }
+
+  void enable(bool enabled) {
+    tracing.store(enabled, std::memory_order_relaxed);
+  }
+
+  bool enabled() {
+    return tracing.load(std::memory_order_relaxed);
+  }
+
+  void record(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, std::int64_t frame, const void *session) {
+    if (!enabled()) {
+      return;
+    }
+
+    auto &buffer = thread_buffer();
+    auto index = buffer.written.load(std::memory_order_relaxed);
+
+    buffer.begun.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto &slot = buffer.slots[index % events_per_thread];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count(), std::memory_order_relaxed);
+    slot.duration_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+    slot.frame.store(frame, std::memory_order_relaxed);
+    slot.session.store(session, std::memory_order_relaxed);
+
+    buffer.written.store(index + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief Copy the events of a buffer that weren't overwritten while copying them.
+   * @param buffer The buffer to copy.
+   * @return The events, oldest first.
+   */
+  static std::vector<event_t> read_events(const buffer_t &buffer) {
+    auto written = buffer.written.load(std::memory_order_acquire);
+    auto first = written > events_per_thread ? written - events_per_thread : 0;
+
+    std::vector<event_t> events;
+    events.reserve(written - first);
+    for (auto index = first; index < written; ++index) {
+      auto &slot = buffer.slots[index % events_per_thread];
+      events.emplace_back(event_t {
+        slot.name.load(std::memory_order_relaxed),
+        slot.start_ns.load(std::memory_order_relaxed),
+        slot.duration_ns.load(std::memory_order_relaxed),
+        slot.frame.load(std::memory_order_relaxed),
+        slot.session.load(std::memory_order_relaxed),
+      });
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto begun = buffer.begun.load(std::memory_order_relaxed);
+
+    // Slots the writer started writing since we loaded `written` may be torn
+    auto overwritten = begun > events_per_thread ? begun - events_per_thread : 0;
+    if (overwritten > first) {
+      events.erase(std::begin(events), std::begin(events) + std::min<std::size_t>(overwritten - first, events.size()));
+    }
+
+    return events;
+  }
+
+  std::string to_chrome_json() {
+    std::vector<std::shared_ptr<buffer_t>> buffers;
+    {
+      std::lock_guard lg {registry_lock};
+      buffers = registry;
+    }
+
+    // Sessions are numbered in the order they first appear in the trace
+    std::map<const void *, int> session_numbers;
+
+    auto trace_events = nlohmann::json::array();
+    for (std::size_t x = 0; x < buffers.size(); ++x) {
+      for (auto &event : read_events(*buffers[x])) {
+        nlohmann::json args;
+        if (event.frame >= 0) {
+          args["frame"] = event.frame;
+        }
+        if (event.session) {
+          args["session"] = session_numbers.try_emplace(event.session, session_numbers.size() + 1).first->second;
+        }
+
+        nlohmann::json trace_event;
+        trace_event["name"] = event.name;
+        trace_event["cat"] = "sunshine";
+        trace_event["ph"] = "X";
+        trace_event["ts"] = event.start_ns / 1000.0;
+        trace_event["dur"] = event.duration_ns / 1000.0;
+        trace_event["pid"] = 1;
+        trace_event["tid"] = x + 1;
+        trace_event["args"] = args;
+
+        trace_events.push_back(std::move(trace_event));
+      }
+    }
+
+    nlohmann::json tree;
+    tree["traceEvents"] = std::move(trace_events);
+    tree["displayTimeUnit"] = "ms";
+    return tree.dump();
+  }
+
+  int dump(const std::filesystem::path &path) {
+    std::ofstream file {path, std::ios::binary | std::ios::trunc};
+    if (!file.is_open()) {
+      BOOST_LOG(error) << "Couldn't open "sv << path << " to write the frame trace"sv;
+      return -1;
+    }
+
+    file << to_chrome_json();
+    if (!file) {
+      BOOST_LOG(error) << "Couldn't write the frame trace to "sv << path;
+      return -1;
+    }
+
+    BOOST_LOG(info) << "Frame trace written to "sv << path;
+    return 0;
+  }
+}  // namespace trace
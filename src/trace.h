@@ -0,0 +1,103 @@
+/**
+ * @file src/trace.h
+ * @brief Declarations for per-frame pipeline tracing.
+ */
+#pragma once
+
+// standard includes
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace trace {
+
+  /**
+   * @brief A timestamped span of work done for a frame.
+   */
+  struct event_t {
+    const char *name;  ///< Name of the stage, must be a string literal
+    std::int64_t start_ns;  ///< Start of the span, relative to the steady clock epoch
+    std::int64_t duration_ns;  ///< Duration of the span
+    std::int64_t frame;  ///< Frame index the span belongs to, or -1 if unknown
+    const void *session;  ///< Session the span belongs to, or nullptr if shared by all sessions
+  };
+
+  /**
+   * @brief Number of events kept per thread, older events are overwritten.
+   */
+  constexpr std::size_t events_per_thread = 16384;
+
+  /**
+   * @brief Enable or disable recording of spans.
+   * @param enabled Whether spans should be recorded.
+   */
+  void enable(bool enabled);
+
+  /**
+   * @brief Check whether spans are being recorded.
+   * @return `true` if spans are being recorded.
+   */
+  bool enabled();
+
+  /**
+   * @brief Record a span on the buffer of the calling thread.
+   * @details This never blocks and never allocates, except for the first span of a thread.
+   * @param name Name of the stage, must be a string literal.
+   * @param start Start of the span.
+   * @param end End of the span.
+   * @param frame Frame index the span belongs to, or -1 if unknown.
+   * @param session Session the span belongs to, or nullptr if shared by all sessions.
+   */
+  void record(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, std::int64_t frame = -1, const void *session = nullptr);
+
+  /**
+   * @brief Records a span covering its own lifetime.
+   * @examples
+   * {
+   *   trace::span_t span {"encode", frame_nr, channel_data};
+   *   encode(...);
+   * }
+   * @examples_end
+   */
+  class span_t {
+  public:
+    span_t(const char *name, std::int64_t frame = -1, const void *session = nullptr):
+        name {name},
+        frame {frame},
+        session {session} {
+      if (enabled()) {
+        start = std::chrono::steady_clock::now();
+      }
+    }
+
+    ~span_t() {
+      if (start != std::chrono::steady_clock::time_point {}) {
+        record(name, start, std::chrono::steady_clock::now(), frame, session);
+      }
+    }
+
+    span_t(const span_t &) = delete;
+    span_t &operator=(const span_t &) = delete;
+
+  private:
+    const char *name;
+    std::int64_t frame;
+    const void *session;
+    std::chrono::steady_clock::time_point start {};
+  };
+
+  /**
+   * @brief Get the recorded spans of all threads in the Chrome trace event format.
+   * @details The result can be loaded in Perfetto (ui.perfetto.dev) or chrome://tracing.
+   * @return The trace as JSON.
+   */
+  std::string to_chrome_json();
+
+  /**
+   * @brief Write the recorded spans of all threads to a file in the Chrome trace event format.
+   * @param path The file to write to.
+   * @return 0 on success, -1 on failure.
+   */
+  int dump(const std::filesystem::path &path);
+}  // namespace trace
@@ -27,7 +27,10 @@ extern "C" {
 #include "logging.h"
 #include "nvenc/nvenc_base.h"
 #include "platform/common.h"
+#include "stats.h"
 #include "sync.h"
+#include "thread_pool.h"
+#include "trace.h"
 #include "video.h"
 
 #ifdef _WIN32
@@ -473,6 +476,82 @@ namespace video {
   auto capture_thread_async = safe::make_shared<capture_thread_async_ctx_t>(start_capture_async, end_capture_async);
   auto capture_thread_sync = safe::make_shared<capture_thread_sync_ctx_t>(start_capture_sync, end_capture_sync);
 
+  /**
+   * @brief A session receiving the packets of a shared encoder.
+   */
+  struct encode_group_member_t {
+    safe::mail_t mail;
+    void *channel_data;
+
+    safe::mail_raw_t::event_t<bool> idr_events;
+    safe::mail_raw_t::event_t<std::pair<int64_t, int64_t>> invalidate_ref_frames_events;
+    safe::mail_raw_t::event_t<hdr_info_t> hdr_events;
+    safe::mail_raw_t::event_t<input::touch_port_t> touch_port_events;
+
+    // Subtracted from the frame index, so each member's frames count from 1 at its first IDR frame
+    std::optional<int64_t> frame_offset;
+  };
+
+  /**
+   * @brief Sessions with identical stream settings, which are all fed by a single encoder.
+   * @details The capture thread of the first member owns the encoder and fans its packets out
+   * to every member. When the owner leaves, the next member takes over with a new encoder.
+   */
+  struct encode_group_t {
+    config_t config;
+
+    std::mutex lock;
+    std::condition_variable owner_changed;
+    std::vector<encode_group_member_t> members;
+
+    // Only used by the owner, but kept across owners so the frame index never goes backwards
+    int frame_nr = 1;
+
+    // Replayed to members joining while the encoder is running
+    std::optional<input::touch_port_t> touch_port;
+    std::optional<hdr_info_raw_t> hdr_info;
+
+    // The encoder of the group queues its packets here, before they are fanned out to the members
+    safe::mail_t mail = std::make_shared<safe::mail_raw_t>();
+  };
+
+  /**
+   * @brief A packet of a shared encoder, as seen by a single member of the encode group.
+   */
+  struct packet_raw_shared_t: packet_raw_t {
+    packet_raw_shared_t(std::shared_ptr<packet_raw_t> packet, void *channel_data, int64_t frame_offset):
+        packet {std::move(packet)},
+        frame_offset {frame_offset} {
+      this->replacements = this->packet->replacements;
+      this->channel_data = channel_data;
+      this->after_ref_frame_invalidation = this->packet->after_ref_frame_invalidation;
+      this->frame_timestamp = this->packet->frame_timestamp;
+      this->queued_at = this->packet->queued_at;
+    }
+
+    bool is_idr() override {
+      return packet->is_idr();
+    }
+
+    int64_t frame_index() override {
+      return packet->frame_index() - frame_offset;
+    }
+
+    uint8_t *data() override {
+      return packet->data();
+    }
+
+    size_t data_size() override {
+      return packet->data_size();
+    }
+
+    std::shared_ptr<packet_raw_t> packet;
+    int64_t frame_offset;
+  };
+
+  static std::mutex encode_groups_lock;
+  static std::vector<std::weak_ptr<encode_group_t>> encode_groups;
+
 #ifdef _WIN32
   encoder_t nvenc {
     "nvenc"sv,
@@ -1130,7 +1209,7 @@ namespace video {
       for (auto &capture_ctx : capture_ctxs) {
         capture_ctx.images->stop();
       }
-      for (auto &capture_ctx : capture_ctx_queue->unsafe()) {
+      for (auto &capture_ctx : capture_ctx_queue->drain()) {
         capture_ctx.images->stop();
       }
     });
@@ -1209,6 +1288,8 @@ namespace video {
     };
 
     auto pull_free_image_callback = [&](std::shared_ptr<platf::img_t> &img_out) -> bool {
+      trace::span_t span {"pull_free_image"};
+
       img_out.reset();
       while (capture_ctx_queue->running()) {
         // pick first allocated but unused
@@ -1259,6 +1340,10 @@ namespace video {
       bool artificial_reinit = false;
 
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured && img->frame_timestamp) {
+          trace::record("capture", *img->frame_timestamp, std::chrono::steady_clock::now());
+        }
+
         KITTY_WHILE_LOOP(auto capture_ctx = std::begin(capture_ctxs), capture_ctx != std::end(capture_ctxs), {
           if (!capture_ctx->images->running()) {
             capture_ctx = capture_ctxs.erase(capture_ctx);
@@ -1381,7 +1466,9 @@ namespace video {
     auto &vps = session.vps;
 
     // send the frame to the encoder
+    auto send_start = std::chrono::steady_clock::now();
     auto ret = avcodec_send_frame(ctx.get(), frame);
+    trace::record("avcodec_send_frame", send_start, std::chrono::steady_clock::now(), frame_nr, channel_data);
     if (ret < 0) {
       char err_str[AV_ERROR_MAX_STRING_SIZE] {0};
       BOOST_LOG(error) << "Could not send a frame for encoding: "sv << av_make_error_string(err_str, AV_ERROR_MAX_STRING_SIZE, ret);
@@ -1439,6 +1526,7 @@ namespace video {
 
       packet->replacements = &session.replacements;
       packet->channel_data = channel_data;
+      packet->queued_at = std::chrono::steady_clock::now();
       packets->raise(std::move(packet));
     }
 
@@ -1460,12 +1548,15 @@ namespace video {
     packet->channel_data = channel_data;
     packet->after_ref_frame_invalidation = encoded_frame.after_ref_frame_invalidation;
     packet->frame_timestamp = frame_timestamp;
+    packet->queued_at = std::chrono::steady_clock::now();
     packets->raise(std::move(packet));
 
     return 0;
   }
 
   int encode(int64_t frame_nr, encode_session_t &session, safe::mail_raw_t::queue_t<packet_t> &packets, void *channel_data, std::optional<std::chrono::steady_clock::time_point> frame_timestamp) {
+    trace::span_t span {"encode", frame_nr, channel_data};
+
     if (auto avcodec_session = dynamic_cast<avcodec_encode_session_t *>(&session)) {
       return encode_avcodec(frame_nr, *avcodec_session, packets, channel_data, frame_timestamp);
     } else if (auto nvenc_session = dynamic_cast<nvenc_encode_session_t *>(&session)) {
@@ -1873,6 +1964,89 @@ namespace video {
     return nullptr;
   }
 
+  /**
+   * @brief Merge the IDR frame and reference frame invalidation requests of all members of an encode group.
+   * @param group The encode group.
+   * @param session The encode session shared by the group.
+   * @return `true` if any member requested an IDR frame.
+   */
+  bool merge_group_requests(encode_group_t &group, encode_session_t &session) {
+    std::lock_guard lg {group.lock};
+
+    bool requested_idr_frame = false;
+    for (auto &member : group.members) {
+      while (member.invalidate_ref_frames_events->peek()) {
+        if (auto frames = member.invalidate_ref_frames_events->pop(0ms)) {
+          auto offset = member.frame_offset.value_or(0);
+          session.invalidate_ref_frames(frames->first + offset, frames->second + offset);
+        }
+      }
+
+      if (member.idr_events->peek()) {
+        requested_idr_frame = true;
+        member.idr_events->pop();
+      }
+    }
+
+    return requested_idr_frame;
+  }
+
+  /**
+   * @brief Pass the packets of a shared encoder on to every member of the encode group.
+   * @param group The encode group.
+   * @param group_packets The packets queued by the shared encoder.
+   * @param packets The queue of the video broadcast thread.
+   */
+  void fan_out_group_packets(encode_group_t &group, safe::mail_raw_t::queue_t<packet_t> &group_packets, safe::mail_raw_t::queue_t<packet_t> &packets) {
+    while (group_packets->peek()) {
+      auto packet = group_packets->pop();
+      if (!packet) {
+        return;
+      }
+
+      std::shared_ptr<packet_raw_t> shared_packet = std::move(*packet);
+
+      std::lock_guard lg {group.lock};
+      for (auto &member : group.members) {
+        // Nothing before the IDR frame the member requested when it started capturing can be decoded by it
+        if (!member.frame_offset) {
+          if (!shared_packet->is_idr()) {
+            continue;
+          }
+
+          member.frame_offset = shared_packet->frame_index() - 1;
+        }
+
+        packets->raise(std::make_unique<packet_raw_shared_t>(shared_packet, member.channel_data, *member.frame_offset));
+      }
+    }
+  }
+
+  /**
+   * @brief Send the state of the captured display to the session, or to every member of its encode group.
+   * @param mail The mail of the session.
+   * @param group The encode group of the session, or `nullptr`.
+   * @param touch_port The touch port of the captured display.
+   * @param hdr_info The HDR state of the captured display.
+   */
+  void raise_display_state(safe::mail_t &mail, encode_group_t *group, const input::touch_port_t &touch_port, const hdr_info_raw_t &hdr_info) {
+    if (!group) {
+      mail->event<input::touch_port_t>(mail::touch_port)->raise(touch_port);
+      mail->event<hdr_info_t>(mail::hdr)->raise(std::make_unique<hdr_info_raw_t>(hdr_info));
+
+      return;
+    }
+
+    std::lock_guard lg {group->lock};
+
+    group->touch_port = touch_port;
+    group->hdr_info = hdr_info;
+    for (auto &member : group->members) {
+      member.touch_port_events->raise(touch_port);
+      member.hdr_events->raise(std::make_unique<hdr_info_raw_t>(hdr_info));
+    }
+  }
+
   void encode_run(
     int &frame_nr,  // Store progress of the frame number
     safe::mail_t mail,
@@ -1882,7 +2056,8 @@ namespace video {
     std::unique_ptr<platf::encode_device_t> encode_device,
     safe::signal_t &reinit_event,
     const encoder_t &encoder,
-    void *channel_data
+    void *channel_data,
+    encode_group_t *group
   ) {
     auto session = make_encode_session(disp.get(), encoder, config, disp->width, disp->height, std::move(encode_device));
     if (!session) {
@@ -1916,6 +2091,18 @@ namespace video {
     auto idr_events = mail->event<bool>(mail::idr);
     auto invalidate_ref_frames_events = mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames);
 
+    logging::time_delta_periodic_logger encode_latency_logger(debug, "Frame encode latency");
+    auto session_stats = stats::find_session(channel_data);
+    if (session_stats) {
+      encode_latency_logger.record_into(&session_stats->encode_latency);
+    }
+
+    // A shared encoder queues its packets for the group, which passes them on to each member
+    safe::mail_raw_t::queue_t<packet_t> group_packets;
+    if (group) {
+      group_packets = group->mail->queue<packet_t>(mail::video_packets);
+    }
+
     {
       // Load a dummy image into the AVFrame to ensure we have something to encode
       // even if we timeout waiting on the first frame. This is a relatively large
@@ -1941,15 +2128,19 @@ namespace video {
 
       bool requested_idr_frame = false;
 
-      while (invalidate_ref_frames_events->peek()) {
-        if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
-          session->invalidate_ref_frames(frames->first, frames->second);
+      if (group) {
+        requested_idr_frame = merge_group_requests(*group, *session);
+      } else {
+        while (invalidate_ref_frames_events->peek()) {
+          if (auto frames = invalidate_ref_frames_events->pop(0ms)) {
+            session->invalidate_ref_frames(frames->first, frames->second);
+          }
         }
-      }
 
-      if (idr_events->peek()) {
-        requested_idr_frame = true;
-        idr_events->pop();
+        if (idr_events->peek()) {
+          requested_idr_frame = true;
+          idr_events->pop();
+        }
       }
 
       if (requested_idr_frame) {
@@ -1962,6 +2153,8 @@ namespace video {
       if (!requested_idr_frame || images->peek()) {
         if (auto img = images->pop(max_frametime)) {
           frame_timestamp = img->frame_timestamp;
+
+          trace::span_t span {"convert", frame_nr, channel_data};
           if (session->convert(*img)) {
             BOOST_LOG(error) << "Could not convert image"sv;
             return;
@@ -1971,10 +2164,16 @@ namespace video {
         }
       }
 
-      if (encode(frame_nr++, *session, packets, channel_data, frame_timestamp)) {
+      encode_latency_logger.first_point_now();
+      if (encode(frame_nr++, *session, group ? group_packets : packets, channel_data, frame_timestamp)) {
         BOOST_LOG(error) << "Could not encode video packet"sv;
         return;
       }
+      encode_latency_logger.second_point_now_and_log();
+
+      if (group) {
+        fan_out_group_packets(*group, group_packets, packets);
+      }
 
       session->request_normal_frame();
     }
@@ -2157,9 +2356,23 @@ namespace video {
       synced_sessions.emplace_back(std::move(*synced_session));
     }
 
+    // Hardware encode devices stay on this thread, which created them: CUDA and NvFBC contexts are
+    // bound to it, and VAAPI and D3D11 device contexts aren't safe to use from arbitrary threads.
+    // Only sessions encoding from system memory are spread over the workers.
+    const bool parallel_encode = encoder.platform_formats->dev_type == platf::mem_type_e::system;
+
+    // Workers encoding all but the first synced session, which grow with the number of sessions
+    thread_pool_util::ThreadPool encode_pool {0};
+    std::size_t encode_pool_threads = 0;
+    std::vector<std::future<void>> encode_futures;
+
     auto ec = platf::capture_e::ok;
     while (encode_session_ctx_queue.running()) {
       auto push_captured_image_callback = [&](std::shared_ptr<platf::img_t> &&img, bool frame_captured) -> bool {
+        if (frame_captured && img->frame_timestamp) {
+          trace::record("capture", *img->frame_timestamp, std::chrono::steady_clock::now());
+        }
+
         while (encode_session_ctx_queue.peek()) {
           auto encode_session_ctx = encode_session_ctx_queue.pop();
           if (!encode_session_ctx) {
@@ -2200,11 +2413,20 @@ namespace video {
             ctx->idr_events->pop();
           }
 
-          if (frame_captured && pos->session->convert(*img)) {
-            BOOST_LOG(error) << "Could not convert image"sv;
-            ctx->shutdown_event->raise(true);
+          ++pos;
+        })
 
-            continue;
+        auto encode_synced_session = [&img, frame_captured](sync_session_t *synced_session) {
+          auto ctx = synced_session->ctx;
+
+          if (frame_captured) {
+            trace::span_t span {"convert", ctx->frame_nr, ctx->channel_data};
+            if (synced_session->session->convert(*img)) {
+              BOOST_LOG(error) << "Could not convert image"sv;
+              ctx->shutdown_event->raise(true);
+
+              return;
+            }
           }
 
           std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
@@ -2212,17 +2434,48 @@ namespace video {
             frame_timestamp = img->frame_timestamp;
           }
 
-          if (encode(ctx->frame_nr++, *pos->session, ctx->packets, ctx->channel_data, frame_timestamp)) {
+          if (encode(ctx->frame_nr++, *synced_session->session, ctx->packets, ctx->channel_data, frame_timestamp)) {
             BOOST_LOG(error) << "Could not encode video packet"sv;
             ctx->shutdown_event->raise(true);
 
-            continue;
+            return;
           }
 
-          pos->session->request_normal_frame();
+          synced_session->session->request_normal_frame();
+        };
 
-          ++pos;
-        })
+        if (!parallel_encode) {
+          for (auto &synced_session : synced_sessions) {
+            encode_synced_session(&synced_session);
+          }
+        } else {
+          // Encode the other sessions on the pool while this thread encodes the first one,
+          // so each frame costs the slowest encode rather than the sum of all of them.
+          if (encode_pool_threads < synced_sessions.size() - 1) {
+            encode_pool.grow((int) (synced_sessions.size() - 1 - encode_pool_threads));
+            encode_pool_threads = synced_sessions.size() - 1;
+          }
+
+          encode_futures.clear();
+          for (auto pos = std::next(std::begin(synced_sessions)); pos != std::end(synced_sessions); ++pos) {
+            encode_futures.emplace_back(encode_pool.push([&encode_synced_session, synced_session = &*pos]() {
+              static thread_local bool priority_adjusted = false;
+              if (!priority_adjusted) {
+                platf::adjust_thread_priority(platf::thread_priority_e::high);
+                priority_adjusted = true;
+              }
+
+              encode_synced_session(synced_session);
+            }));
+          }
+
+          encode_synced_session(&synced_sessions.front());
+        }
+
+        // The captured image is reused for the next frame, so wait until every session converted it
+        for (auto &future : encode_futures) {
+          future.wait();
+        }
 
         if (switch_display_event->peek()) {
           ec = platf::capture_e::reinit;
@@ -2266,7 +2519,7 @@ namespace video {
         ctx->join_event->raise(true);
       }
 
-      for (auto &ctx : ctx.unsafe()) {
+      for (auto &ctx : ctx.drain()) {
         ctx.shutdown_event->raise(true);
         ctx.join_event->raise(true);
       }
@@ -2280,6 +2533,110 @@ namespace video {
     while (encode_run_sync(synced_session_ctxs, ctx, display_names, display_p) == encode_e::reinit) {}
   }
 
+  /**
+   * @brief Join the encode group for the stream settings of a session, creating it if needed.
+   * @param mail The mail of the session.
+   * @param config The stream settings of the session.
+   * @param channel_data The session, passed on to the video broadcast thread.
+   * @return The encode group.
+   */
+  std::shared_ptr<encode_group_t> join_encode_group(safe::mail_t &mail, const config_t &config, void *channel_data) {
+    auto normalized_config = config;
+    if (!normalized_config.framerateX100) {
+      normalized_config.framerateX100 = normalized_config.framerate * 100;
+    }
+
+    encode_group_member_t member {
+      mail,
+      channel_data,
+      mail->event<bool>(mail::idr),
+      mail->event<std::pair<int64_t, int64_t>>(mail::invalidate_ref_frames),
+      mail->event<hdr_info_t>(mail::hdr),
+      mail->event<input::touch_port_t>(mail::touch_port),
+    };
+
+    std::lock_guard lg {encode_groups_lock};
+
+    std::erase_if(encode_groups, [](auto &group) {
+      return group.expired();
+    });
+
+    for (auto &group_wp : encode_groups) {
+      auto group = group_wp.lock();
+      if (!group) {
+        continue;
+      }
+
+      std::lock_guard group_lg {group->lock};
+      if (group->members.empty() || group->config != normalized_config) {
+        continue;
+      }
+
+      // Catch up on the display state, the IDR frame requested by capture() is merged in by the owner
+      if (group->touch_port) {
+        member.touch_port_events->raise(*group->touch_port);
+      }
+      if (group->hdr_info) {
+        member.hdr_events->raise(std::make_unique<hdr_info_raw_t>(*group->hdr_info));
+      }
+
+      BOOST_LOG(info) << "Sharing the video encoder with "sv << group->members.size() << " other session(s)"sv;
+      group->members.emplace_back(std::move(member));
+
+      return group;
+    }
+
+    auto group = std::make_shared<encode_group_t>();
+    group->config = normalized_config;
+    group->members.emplace_back(std::move(member));
+    encode_groups.emplace_back(group);
+
+    return group;
+  }
+
+  /**
+   * @brief Leave an encode group, handing the encoder over to the next member if we owned it.
+   * @param group The encode group.
+   * @param channel_data The session leaving the group.
+   */
+  void leave_encode_group(encode_group_t &group, void *channel_data) {
+    std::lock_guard lg {group.lock};
+
+    auto it = std::find_if(std::begin(group.members), std::end(group.members), [channel_data](auto &member) {
+      return member.channel_data == channel_data;
+    });
+    if (it == std::end(group.members)) {
+      return;
+    }
+
+    if (it == std::begin(group.members)) {
+      group.owner_changed.notify_all();
+    }
+    group.members.erase(it);
+  }
+
+  /**
+   * @brief Wait until the session owns the encoder of its encode group.
+   * @param group The encode group.
+   * @param channel_data The waiting session.
+   * @param shutdown_event The shutdown event of the waiting session.
+   * @return `true` if the session owns the encoder, `false` if the session is shutting down.
+   */
+  bool wait_for_encode_group(encode_group_t &group, void *channel_data, safe::mail_raw_t::event_t<bool> &shutdown_event) {
+    std::unique_lock ul {group.lock};
+
+    while (group.members.front().channel_data != channel_data) {
+      if (shutdown_event->peek()) {
+        return false;
+      }
+
+      // The shutdown event can't wake us up, so check it periodically
+      group.owner_changed.wait_for(ul, 100ms);
+    }
+
+    return true;
+  }
+
   void capture_async(
     safe::mail_t mail,
     config_t &config,
@@ -2287,6 +2644,20 @@ namespace video {
   ) {
     auto shutdown_event = mail->event<bool>(mail::shutdown);
 
+    // Sessions with identical stream settings share the encoder of the first one
+    std::shared_ptr<encode_group_t> group;
+    auto leave_group = util::fail_guard([&]() {
+      if (group) {
+        leave_encode_group(*group, channel_data);
+      }
+    });
+    if (config::video.shared_encode) {
+      group = join_encode_group(mail, config, channel_data);
+      if (!wait_for_encode_group(*group, channel_data, shutdown_event)) {
+        return;
+      }
+    }
+
     auto images = std::make_shared<img_event_t::element_type>();
     auto lg = util::fail_guard([&]() {
       images->stop();
@@ -2304,10 +2675,8 @@ namespace video {
       return;
     }
 
-    int frame_nr = 1;
-
-    auto touch_port_event = mail->event<input::touch_port_t>(mail::touch_port);
-    auto hdr_event = mail->event<hdr_info_t>(mail::hdr);
+    int session_frame_nr = 1;
+    auto &frame_nr = group ? group->frame_nr : session_frame_nr;
 
     // Encoding takes place on this thread
     platf::adjust_thread_priority(platf::thread_priority_e::high);
@@ -2336,19 +2705,18 @@ namespace video {
         return;
       }
 
-      // absolute mouse coordinates require that the dimensions of the screen are known
-      touch_port_event->raise(make_port(display.get(), config));
-
       // Update client with our current HDR display state
-      hdr_info_t hdr_info = std::make_unique<hdr_info_raw_t>(false);
+      hdr_info_raw_t hdr_info {false};
       if (colorspace_is_hdr(encode_device->colorspace)) {
-        if (display->get_hdr_metadata(hdr_info->metadata)) {
-          hdr_info->enabled = true;
+        if (display->get_hdr_metadata(hdr_info.metadata)) {
+          hdr_info.enabled = true;
         } else {
           BOOST_LOG(error) << "Couldn't get display hdr metadata when colorspace selection indicates it should have one";
         }
       }
-      hdr_event->raise(std::move(hdr_info));
+
+      // absolute mouse coordinates require that the dimensions of the screen are known
+      raise_display_state(mail, group.get(), make_port(display.get(), config), hdr_info);
 
       encode_run(
         frame_nr,
@@ -2359,7 +2727,8 @@ namespace video {
         std::move(encode_device),
         ref->reinit_event,
         *ref->encoder_p,
-        channel_data
+        channel_data,
+        group.get()
       );
     }
   }
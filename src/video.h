@@ -43,6 +43,8 @@ namespace video {
     int chromaSamplingType;  // 0 - 4:2:0, 1 - 4:4:4
 
     int enableIntraRefresh;  // 0 - disabled, 1 - enabled
+
+    bool operator==(const config_t &) const = default;
   };
 
   platf::mem_type_e map_base_dev_type(AVHWDeviceType type);
@@ -257,6 +259,7 @@ namespace video {
     void *channel_data = nullptr;
     bool after_ref_frame_invalidation = false;
     std::optional<std::chrono::steady_clock::time_point> frame_timestamp;
+    std::chrono::steady_clock::time_point queued_at;
   };
 
   struct packet_raw_avcodec: packet_raw_t {
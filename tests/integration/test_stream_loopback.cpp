@@ -0,0 +1,191 @@
+/**
+ * @file tests/integration/test_stream_loopback.cpp
+ * @brief Test stream sessions end to end, with a protocol client on the loopback interface.
+ */
+#include "../tests_common.h"
+#include "../tests_loopback_client.h"
+
+#include <src/config.h>
+#include <src/input.h>
+#include <src/network.h>
+#include <src/rtsp.h>
+#include <src/stream.h>
+#include <src/video.h>
+
+using namespace std::literals;
+
+namespace {
+  /**
+   * @brief How to stream, and what the client does to the stream.
+   */
+  struct run_t {
+    int fec_percentage;
+    bool encrypted;
+    double loss;
+  };
+}  // namespace
+
+/**
+ * @brief Streams the synthetic display to a loopback client, through the software encoder.
+ * @details The display and encoder are probed once for the whole suite. Every test then
+ * streams for a couple of seconds and checks what the client measured.
+ */
+struct StreamLoopbackTest: testing::Test {
+  static void SetUpTestSuite() {
+    if (!IS_LINUX) {
+      return;  // The synthetic display is Linux only
+    }
+
+    saved_video = config::video;
+    saved_stream = config::stream;
+    saved_audio = config::audio;
+    saved_port = config::sunshine.port;
+
+    config::video.capture = "synthetic";
+    config::video.synthetic_pattern = "damage";
+    config::video.encoder = "software";
+    config::stream.adaptive_fec = false;
+    config::stream.ping_timeout = 30s;  // There is no control stream to keep the session alive
+    config::audio.stream = false;  // Build machines have no audio devices
+    config::sunshine.port = 58989;  // Away from a Sunshine instance that may be running
+
+    task_pool.start(1);
+    platf_deinit = platf::init();
+    ASSERT_TRUE(platf_deinit);
+    input_deinit = input::init();
+    reed_solomon_init();
+
+    ASSERT_EQ(video::probe_encoders(), 0);
+    ready = true;
+  }
+
+  static void TearDownTestSuite() {
+    if (!IS_LINUX) {
+      return;
+    }
+
+    ready = false;
+    input_deinit = {};
+    platf_deinit = {};
+    task_pool.stop();
+    task_pool.join();
+
+    config::video = saved_video;
+    config::stream = saved_stream;
+    config::audio = saved_audio;
+    config::sunshine.port = saved_port;
+  }
+
+  void SetUp() override {
+    if (!IS_LINUX) {
+      GTEST_SKIP() << "The synthetic display is only available on Linux";
+    }
+    ASSERT_TRUE(ready);
+  }
+
+  /**
+   * @brief Stream to a loopback client.
+   * @param run How to stream.
+   * @param duration How long to stream for.
+   * @return What the client measured.
+   */
+  const loopback_client::stats_t &stream(const run_t &run, std::chrono::seconds duration = 3s) {
+    config::stream.fec_percentage = run.fec_percentage;
+
+    rtsp_stream::launch_session_t launch_session {};
+    launch_session.id = 1;
+    auto key = crypto::rand(16);
+    launch_session.gcm_key.assign(std::begin(key), std::end(key));
+    auto iv = crypto::rand(16);
+    launch_session.iv.assign(std::begin(iv), std::end(iv));
+    launch_session.av_ping_payload = util::hex_vec(crypto::rand(8));
+
+    stream::config_t config {};
+    config.packetsize = 1392;
+    config.minRequiredFecPackets = 2;
+    config.mlFeatureFlags = ML_FF_SESSION_ID_V1;
+    config.encryptionFlagsEnabled = run.encrypted ? SS_ENC_VIDEO : 0;
+    config.audio.packetDuration = 5;
+    config.audio.channels = 2;
+    config.audio.mask = 0x3;
+    config.monitor.width = 640;
+    config.monitor.height = 360;
+    config.monitor.framerate = 30;
+    config.monitor.bitrate = 2000;
+    config.monitor.slicesPerFrame = 1;
+    config.monitor.numRefFrames = 1;
+
+    client.emplace(launch_session.gcm_key, launch_session.av_ping_payload, run.encrypted, run.loss);
+
+    auto session = stream::session::alloc(config, launch_session);
+    if (!session || stream::session::start(*session, "127.0.0.1"s)) {
+      ADD_FAILURE() << "Failed to start the streaming session";
+      return client->stop();
+    }
+
+    client->start(net::map_port(stream::VIDEO_STREAM_PORT), net::map_port(stream::AUDIO_STREAM_PORT));
+    std::this_thread::sleep_for(duration);
+
+    stream::session::stop(*session);
+    stream::session::join(*session);
+
+    auto &stats = client->stop();
+    auto completion = stats.frame_completion_ms.snapshot();
+    BOOST_LOG(tests) << "FEC "sv << run.fec_percentage << "%, "sv << (run.encrypted ? "encrypted, "sv : ""sv) << run.loss * 100 << "% loss: "sv
+                     << stats.frames_complete << " frames complete ("sv << stats.frames_recovered << " recovered), "sv
+                     << stats.frames_incomplete << " incomplete, "sv << stats.shards_recovered << '/' << stats.shards_dropped << " shards recovered, "sv
+                     << stats.video_kbps() << " Kbps, jitter "sv << stats.jitter_ms << " ms, completion p50/p99 "sv
+                     << completion.percentile(50) << '/' << completion.percentile(99) << " ms"sv;
+
+    return stats;
+  }
+
+  std::optional<loopback_client::client_t> client;
+
+  inline static config::video_t saved_video;
+  inline static config::stream_t saved_stream;
+  inline static config::audio_t saved_audio;
+  inline static std::uint16_t saved_port;
+
+  inline static std::unique_ptr<platf::deinit_t> platf_deinit;
+  inline static std::unique_ptr<platf::deinit_t> input_deinit;
+  inline static bool ready = false;
+};
+
+TEST_F(StreamLoopbackTest, ReceivesEveryFrameWithoutLoss) {
+  auto &stats = stream({20, false, 0});
+
+  ASSERT_GT(stats.frames_complete, 30u);
+  ASSERT_LE(stats.frames_incomplete, 1u);  // The session may stop halfway through a frame
+  ASSERT_EQ(stats.frames_recovered, 0u);
+  ASSERT_EQ(stats.frames_malformed, 0u);
+  ASSERT_GT(stats.video_kbps(), 0);
+}
+
+TEST_F(StreamLoopbackTest, RecoversLossWithinFecBudget) {
+  auto &stats = stream({50, false, 0.05});
+
+  ASSERT_GT(stats.shards_dropped, 0u);
+  ASSERT_GT(stats.shards_recovered, 0u);
+  ASSERT_EQ(stats.recovery_mismatches, 0u);
+  ASSERT_EQ(stats.frames_malformed, 0u);
+  ASSERT_GT(stats.frames_recovered, 0u);
+  ASSERT_GE(stats.frames_complete, (stats.frames_complete + stats.frames_incomplete) * 9 / 10);
+}
+
+TEST_F(StreamLoopbackTest, RecoversLossOfEncryptedStream) {
+  auto &stats = stream({50, true, 0.05});
+
+  ASSERT_EQ(stats.decrypt_errors, 0u);
+  ASSERT_GT(stats.shards_recovered, 0u);
+  ASSERT_EQ(stats.recovery_mismatches, 0u);
+  ASSERT_EQ(stats.frames_malformed, 0u);
+  ASSERT_GE(stats.frames_complete, (stats.frames_complete + stats.frames_incomplete) * 9 / 10);
+}
+
+TEST_F(StreamLoopbackTest, ReportsLossWithoutFec) {
+  auto &stats = stream({0, false, 0.2});
+
+  ASSERT_GT(stats.frames_incomplete, 0u);
+  ASSERT_EQ(stats.shards_recovered, 0u);
+}
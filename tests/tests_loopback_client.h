@@ -0,0 +1,418 @@
+/**
+ * @file tests/tests_loopback_client.h
+ * @brief A minimal Moonlight protocol receiver for stream sessions on the loopback interface.
+ */
+#pragma once
+
+// standard includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lib includes
+#include <boost/asio.hpp>
+
+extern "C" {
+#include <moonlight-common-c/src/Limelight-internal.h>
+#include <src/rswrapper.h>
+}
+
+// local includes
+#include <src/crypto.h>
+#include <src/stat_trackers.h>
+#include <src/utility.h>
+
+namespace stream::fec {
+  reed_solomon *codec_for(size_t data_shards, size_t parity_shards);
+}
+
+namespace loopback_client {
+  using namespace std::literals;
+  namespace asio = boost::asio;
+  using asio::ip::udp;
+
+  /**
+   * @brief What the client measured of a stream.
+   */
+  struct stats_t {
+    std::uint64_t video_packets = 0;
+    std::uint64_t video_bytes = 0;
+    std::uint64_t audio_packets = 0;
+    std::uint64_t audio_bytes = 0;
+
+    std::uint64_t frames_complete = 0;  ///< Frames whose FEC blocks could all be reassembled
+    std::uint64_t frames_recovered = 0;  ///< Complete frames that needed FEC to be reassembled
+    std::uint64_t frames_incomplete = 0;  ///< Frames that lost more shards than FEC could recover
+    std::uint64_t frames_malformed = 0;  ///< Complete frames that don't start with a frame header
+
+    std::uint64_t shards_dropped = 0;  ///< Shards dropped on purpose to simulate loss
+    std::uint64_t shards_recovered = 0;  ///< Dropped data shards rebuilt from the parity shards
+    std::uint64_t recovery_mismatches = 0;  ///< Rebuilt data shards whose payload differs from the dropped one
+    std::uint64_t decrypt_errors = 0;
+
+    double jitter_ms = 0;  ///< Interarrival jitter of the video frames, as defined by RFC 3550
+    double duration_s = 0;  ///< Time from the first to the last packet received
+
+    stat_trackers::histogram_t frame_completion_ms;  ///< Time from the first packet of a frame until it could be reassembled
+
+    /**
+     * @brief Get the bitrate of the video stream as received, including FEC and headers.
+     * @return The bitrate, in Kbps.
+     */
+    double video_kbps() const {
+      return duration_s > 0 ? video_bytes * 8 / duration_s / 1000 : 0;
+    }
+  };
+
+  /**
+   * @brief Receives the video and audio streams of a session over loopback UDP.
+   * @details It pings the session like Moonlight does, then reassembles the FEC blocks of every
+   * video frame. It can drop shards on purpose to measure how well FEC recovers from loss. Audio
+   * packets are only counted. There is no control stream and nothing is decoded.
+   * @examples
+   * loopback_client::client_t client {launch_session.gcm_key, launch_session.av_ping_payload, encrypted, 0.05};
+   * client.start(net::map_port(stream::VIDEO_STREAM_PORT), net::map_port(stream::AUDIO_STREAM_PORT));
+   * std::this_thread::sleep_for(2s);
+   * auto &stats = client.stop();
+   * @examples_end
+   */
+  class client_t {
+  public:
+    /**
+     * @param gcm_key The key the video stream is encrypted with.
+     * @param ping_payload The payload identifying the session in pings.
+     * @param encrypted Whether the video stream is encrypted.
+     * @param loss The fraction of video shards to drop, from 0 to 1.
+     * @param seed The seed of the random shard drops, so runs can be repeated.
+     */
+    client_t(const crypto::aes_t &gcm_key, std::string ping_payload, bool encrypted, double loss, std::uint32_t seed = 1):
+        cipher {gcm_key, false},
+        ping_payload {std::move(ping_payload)},
+        encrypted {encrypted},
+        loss {loss},
+        random {seed} {
+    }
+
+    ~client_t() {
+      stop();
+    }
+
+    client_t(const client_t &) = delete;
+    client_t &operator=(const client_t &) = delete;
+
+    /**
+     * @brief Start pinging and receiving on a thread of its own.
+     * @param video_port The video port of the session on the loopback interface.
+     * @param audio_port The audio port of the session on the loopback interface.
+     */
+    void start(std::uint16_t video_port, std::uint16_t audio_port) {
+      video_peer = udp::endpoint {asio::ip::address_v4::loopback(), video_port};
+      audio_peer = udp::endpoint {asio::ip::address_v4::loopback(), audio_port};
+
+      sock.open(udp::v4());
+      sock.bind(udp::endpoint {asio::ip::address_v4::loopback(), 0});
+      sock.set_option(asio::socket_base::receive_buffer_size {8 * 1024 * 1024});
+
+      running = true;
+      thread = std::thread {&client_t::run, this};
+    }
+
+    /**
+     * @brief Stop receiving.
+     * @return What was measured, frames still in flight count as incomplete.
+     */
+    const stats_t &stop() {
+      if (thread.joinable()) {
+        running = false;
+        thread.join();
+
+        for (auto &[index, frame] : frames) {
+          if (!frame.complete) {
+            ++stats.frames_incomplete;
+          }
+        }
+        frames.clear();
+      }
+
+      return stats;
+    }
+
+  private:
+    /**
+     * @brief The shards of a FEC block received so far.
+     */
+    struct block_t {
+      int data_shards = 0;
+      int parity_shards = 0;
+      bool complete = false;
+
+      std::map<int, std::vector<std::uint8_t>> shards;
+      std::map<int, std::vector<std::uint8_t>> dropped;
+    };
+
+    struct frame_t {
+      std::chrono::steady_clock::time_point first_packet;
+      int nr_blocks = 0;
+      bool complete = false;
+      bool recovered = false;
+      std::array<block_t, 4> blocks;
+    };
+
+    // Everything before the payload of a video shard
+    static constexpr std::size_t header_size = sizeof(RTP_PACKET) + 4 + sizeof(NV_VIDEO_PACKET);
+    static constexpr std::size_t enc_prefix_size = 12 + sizeof(std::uint32_t) + crypto::cipher::tag_size;
+
+    void send_pings() {
+      SS_PING ping {};
+      std::copy_n(ping_payload.data(), std::min(ping_payload.size(), sizeof(ping.payload)), ping.payload);
+      ping.sequenceNumber = util::endian::big(++ping_sequence);
+
+      boost::system::error_code ec;
+      sock.send_to(asio::buffer(&ping, sizeof(ping)), video_peer, 0, ec);
+      sock.send_to(asio::buffer(&ping, sizeof(ping)), audio_peer, 0, ec);
+    }
+
+    void run() {
+      std::array<std::uint8_t, 2048> buffer;
+      udp::endpoint peer;
+      bool receiving = false;
+
+      // Moonlight pings until the stream starts, then keeps pinging to keep NAT mappings alive
+      auto next_ping = std::chrono::steady_clock::now();
+
+      while (running) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_ping) {
+          send_pings();
+          next_ping = now + (stats.video_packets ? 500ms : 100ms);
+        }
+
+        if (!receiving) {
+          receiving = true;
+          sock.async_receive_from(asio::buffer(buffer), peer, [&](const boost::system::error_code &ec, std::size_t bytes) {
+            receiving = false;
+            if (!ec) {
+              on_datagram(peer, std::span {buffer.data(), bytes});
+            }
+          });
+        }
+
+        io_context.run_one_for(50ms);
+        if (io_context.stopped()) {
+          io_context.restart();
+        }
+      }
+
+      // Let the pending receive complete as aborted, before its buffer goes away
+      sock.close();
+      io_context.restart();
+      io_context.run();
+    }
+
+    void on_datagram(const udp::endpoint &peer, std::span<std::uint8_t> datagram) {
+      auto now = std::chrono::steady_clock::now();
+
+      if (peer == audio_peer) {
+        ++stats.audio_packets;
+        stats.audio_bytes += datagram.size();
+        return;
+      }
+
+      if (peer != video_peer) {
+        return;
+      }
+
+      if (!stats.video_packets) {
+        first_packet = now;
+      }
+      ++stats.video_packets;
+      stats.video_bytes += datagram.size();
+      stats.duration_s = std::chrono::duration<double>(now - first_packet).count();
+
+      std::vector<std::uint8_t> shard;
+      if (encrypted) {
+        if (datagram.size() < enc_prefix_size + header_size) {
+          ++stats.decrypt_errors;
+          return;
+        }
+
+        crypto::aes_t iv(datagram.data(), datagram.data() + 12);
+        std::string_view tagged_cipher {(const char *) datagram.data() + 12 + sizeof(std::uint32_t), datagram.size() - 12 - sizeof(std::uint32_t)};
+        if (cipher.decrypt(tagged_cipher, shard, &iv)) {
+          ++stats.decrypt_errors;
+          return;
+        }
+      } else {
+        shard.assign(std::begin(datagram), std::end(datagram));
+      }
+
+      if (shard.size() < header_size) {
+        return;
+      }
+
+      auto *rtp = (PRTP_PACKET) shard.data();
+      auto *packet = (PNV_VIDEO_PACKET) (shard.data() + sizeof(RTP_PACKET) + 4);
+
+      auto shard_index = (int) ((packet->fecInfo >> 12) & 0x3ff);
+      auto data_shards = (int) ((packet->fecInfo >> 22) & 0x3ff);
+      auto fec_percentage = (int) ((packet->fecInfo >> 4) & 0xff);
+      auto block_index = (packet->multiFecBlocks >> 4) & 0x3;
+      auto last_block = (packet->multiFecBlocks >> 6) & 0x3;
+
+      auto [it, inserted] = frames.try_emplace(packet->frameIndex);
+      auto &frame = it->second;
+      if (inserted) {
+        frame.first_packet = now;
+        frame.nr_blocks = last_block + 1;
+        on_new_frame(packet->frameIndex, util::endian::big(rtp->timestamp), now);
+      }
+
+      auto &block = frame.blocks[block_index];
+      if (frame.complete || block.complete) {
+        return;  // Leftover parity shards
+      }
+
+      block.data_shards = data_shards;
+      block.parity_shards = (data_shards * fec_percentage + 99) / 100;
+
+      if (loss > 0 && std::uniform_real_distribution<double> {0, 1}(random) < loss) {
+        ++stats.shards_dropped;
+        block.dropped.emplace(shard_index, std::move(shard));
+        return;
+      }
+      block.shards.emplace(shard_index, std::move(shard));
+
+      if ((int) block.shards.size() < block.data_shards) {
+        return;
+      }
+
+      if (!reassemble(block)) {
+        return;
+      }
+      frame.recovered |= !block.dropped.empty();
+
+      for (int x = 0; x < frame.nr_blocks; ++x) {
+        if (!frame.blocks[x].complete) {
+          return;
+        }
+      }
+
+      frame.complete = true;
+      ++stats.frames_complete;
+      stats.frames_recovered += frame.recovered;
+      stats.frame_completion_ms.record(std::chrono::duration<double, std::milli>(now - frame.first_packet).count());
+
+      // Every frame starts with the short frame header, whose type is always 1
+      auto &first_shard = frame.blocks[0].shards.begin()->second;
+      if (frame.blocks[0].shards.begin()->first != 0 || first_shard[header_size] != 0x01) {
+        ++stats.frames_malformed;
+      }
+    }
+
+    /**
+     * @brief Rebuild the missing data shards of a block from its parity shards.
+     * @return `true` if every data shard of the block is available.
+     */
+    bool reassemble(block_t &block) {
+      auto nr_shards = block.data_shards + block.parity_shards;
+      auto blocksize = block.shards.begin()->second.size();
+
+      std::vector<std::uint8_t *> shards_p(nr_shards);
+      std::vector<std::uint8_t> marks(nr_shards, 1);
+      for (auto &[index, shard] : block.shards) {
+        if (index < nr_shards && shard.size() == blocksize) {
+          shards_p[index] = shard.data();
+          marks[index] = 0;
+        }
+      }
+
+      std::vector<int> missing;
+      for (int x = 0; x < block.data_shards; ++x) {
+        if (marks[x]) {
+          missing.emplace_back(x);
+        }
+      }
+
+      if (!missing.empty()) {
+        std::vector<std::vector<std::uint8_t>> rebuilt(nr_shards);
+        for (int x = 0; x < nr_shards; ++x) {
+          if (marks[x]) {
+            rebuilt[x].resize(blocksize);
+            shards_p[x] = rebuilt[x].data();
+          }
+        }
+
+        if (reed_solomon_decode(stream::fec::codec_for(block.data_shards, block.parity_shards), shards_p.data(), marks.data(), nr_shards, blocksize)) {
+          return false;
+        }
+
+        // The headers were filled in after the parity was computed, so only the payload can be rebuilt
+        for (auto x : missing) {
+          auto dropped = block.dropped.find(x);
+          if (dropped == std::end(block.dropped) || dropped->second.size() != blocksize ||
+              !std::equal(std::begin(rebuilt[x]) + header_size, std::end(rebuilt[x]), std::begin(dropped->second) + header_size)) {
+            ++stats.recovery_mismatches;
+          }
+
+          ++stats.shards_recovered;
+          block.shards.insert_or_assign(x, std::move(rebuilt[x]));
+        }
+      }
+
+      block.complete = true;
+      return true;
+    }
+
+    /**
+     * @brief Update the jitter with the first packet of a frame, and forget frames long gone.
+     */
+    void on_new_frame(std::uint32_t frame_index, std::uint32_t rtp_timestamp, std::chrono::steady_clock::time_point now) {
+      if (last_frame_arrival) {
+        // The RTP timestamps of video use a 90 KHz clock
+        auto arrival_ms = std::chrono::duration<double, std::milli>(now - *last_frame_arrival).count();
+        auto timestamp_ms = (std::int32_t) (rtp_timestamp - last_rtp_timestamp) / 90.0;
+        stats.jitter_ms += (std::abs(arrival_ms - timestamp_ms) - stats.jitter_ms) / 16;
+      }
+      last_frame_arrival = now;
+      last_rtp_timestamp = rtp_timestamp;
+
+      while (!frames.empty() && frame_index - frames.begin()->first > 16) {
+        if (!frames.begin()->second.complete) {
+          ++stats.frames_incomplete;
+        }
+        frames.erase(frames.begin());
+      }
+    }
+
+    crypto::cipher::gcm_t cipher;
+    std::string ping_payload;
+    bool encrypted;
+    double loss;
+    std::mt19937 random;
+
+    asio::io_context io_context;
+    udp::socket sock {io_context};
+    udp::endpoint video_peer;
+    udp::endpoint audio_peer;
+    std::uint32_t ping_sequence = 0;
+
+    std::atomic_bool running {false};
+    std::thread thread;
+
+    std::map<std::uint32_t, frame_t> frames;
+    std::chrono::steady_clock::time_point first_packet;
+    std::optional<std::chrono::steady_clock::time_point> last_frame_arrival;
+    std::uint32_t last_rtp_timestamp = 0;
+
+    stats_t stats;
+  };
+}  // namespace loopback_client
@@ -4,8 +4,11 @@
  */
 #include "../../tests_common.h"
 
+#include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/host_name.hpp>
+#include <boost/asio/ip/udp.hpp>
 #include <src/platform/common.h>
+#include <thread>
 
 struct SetEnvTest: ::testing::TestWithParam<std::tuple<std::string, std::string, int>> {
 protected:
@@ -53,3 +56,53 @@ TEST(HostnameTests, TestAsioEquality) {
   // These should be equivalent on all platforms for ASCII hostnames
   ASSERT_EQ(platf::get_host_name(), boost::asio::ip::host_name());
 }
+
+TEST(HighPrecisionTimerTests, NeverWakesEarlyTest) {
+  auto timer = platf::create_high_precision_timer();
+  ASSERT_TRUE(timer && *timer);
+
+  // Sleep for the same 1ms period the video pacing uses
+  for (int x = 0; x < 50; ++x) {
+    auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+    timer->sleep_for(due - std::chrono::steady_clock::now());
+
+#ifdef __linux__
+    // The timer sleeps until an absolute deadline, so it must never wake up early
+    ASSERT_GE(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - due).count(), 0.0);
+#endif
+  }
+}
+
+TEST(RecvBatchTests, ReceivesBurstTest) {
+  boost::asio::io_context io;
+  boost::asio::ip::udp::socket receiver {io, boost::asio::ip::udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+  boost::asio::ip::udp::socket sender {io, boost::asio::ip::udp::endpoint {boost::asio::ip::address_v4::loopback(), 0}};
+
+  for (auto payload : {"first"sv, "second"sv, "third"sv}) {
+    sender.send_to(boost::asio::buffer(payload), receiver.local_endpoint());
+  }
+
+  std::array<std::array<char, 64>, 8> buffers;
+  std::array<boost::asio::ip::udp::endpoint, 8> peers;
+  std::array<platf::recv_datagram_t, 8> datagrams;
+  for (std::size_t x = 0; x < datagrams.size(); ++x) {
+    datagrams[x] = {buffers[x].data(), buffers[x].size(), (sockaddr *) peers[x].data(), peers[x].capacity()};
+  }
+
+  // Loopback delivery is immediate, but give the datagrams a moment to be queued
+  std::this_thread::sleep_for(10ms);
+
+  auto received = platf::recv_batch(receiver.native_handle(), datagrams);
+#ifdef __linux__
+  ASSERT_EQ(received, 3);
+  ASSERT_EQ((std::string_view {datagrams[1].buffer, datagrams[1].bytes}), "second"sv);
+
+  peers[0].resize(datagrams[0].peer_bytes);
+  ASSERT_EQ(peers[0], sender.local_endpoint());
+
+  // Nothing else is waiting, so this must not block
+  ASSERT_EQ(platf::recv_batch(receiver.native_handle(), datagrams), 0);
+#else
+  ASSERT_EQ(received, -1);
+#endif
+}
@@ -0,0 +1,146 @@
+/**
+ * @file tests/unit/test_stat_trackers.cpp
+ * @brief Test src/stat_trackers.*
+ */
+#include "../tests_common.h"
+
+#include <src/stat_trackers.h>
+#include <thread>
+
+TEST(HistogramTests, EmptyTest) {
+  stat_trackers::histogram_t histogram;
+  auto snapshot = histogram.snapshot();
+
+  ASSERT_EQ(snapshot.count, 0u);
+  ASSERT_EQ(snapshot.percentile(50), 0);
+  ASSERT_EQ(snapshot.mean(), 0);
+}
+
+TEST(HistogramTests, PercentilesTest) {
+  stat_trackers::histogram_t histogram;
+  for (int x = 1; x <= 1000; ++x) {
+    histogram.record(x);
+  }
+
+  auto snapshot = histogram.snapshot();
+  ASSERT_EQ(snapshot.count, 1000u);
+  ASSERT_DOUBLE_EQ(snapshot.min, 1);
+  ASSERT_DOUBLE_EQ(snapshot.max, 1000);
+  ASSERT_DOUBLE_EQ(snapshot.mean(), 500.5);
+
+  // Buckets are at most 1/8 of their lower bound wide
+  for (double p : {1.0, 50.0, 90.0, 99.0, 99.9}) {
+    auto expected = p * 10;
+    ASSERT_NEAR(snapshot.percentile(p), expected, expected * 0.0625) << "p" << p;
+  }
+  ASSERT_DOUBLE_EQ(snapshot.percentile(100), 1000);
+}
+
+TEST(HistogramTests, SmallValuesTest) {
+  stat_trackers::histogram_t histogram;
+  histogram.record(0.002);
+  histogram.record(0.004);
+  histogram.record(-1);
+
+  auto snapshot = histogram.snapshot();
+  ASSERT_DOUBLE_EQ(snapshot.min, 0);
+  ASSERT_DOUBLE_EQ(snapshot.percentile(50), 0.002);
+  ASSERT_DOUBLE_EQ(snapshot.max, 0.004);
+}
+
+TEST(HistogramTests, ConcurrentRecordTest) {
+  stat_trackers::histogram_t histogram;
+
+  std::vector<std::thread> threads;
+  for (int x = 0; x < 4; ++x) {
+    threads.emplace_back([&histogram]() {
+      for (int y = 0; y < 10000; ++y) {
+        histogram.record(y % 100);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  auto snapshot = histogram.snapshot();
+  ASSERT_EQ(snapshot.count, 40000u);
+  ASSERT_DOUBLE_EQ(snapshot.sum, 4 * 100 * 4950);
+}
+
+TEST(HistogramTests, ResetTest) {
+  stat_trackers::histogram_t histogram;
+  histogram.record(5);
+  histogram.reset();
+  histogram.record(2);
+
+  auto snapshot = histogram.snapshot();
+  ASSERT_EQ(snapshot.count, 1u);
+  ASSERT_DOUBLE_EQ(snapshot.min, 2);
+  ASSERT_DOUBLE_EQ(snapshot.max, 2);
+}
+
+TEST(HistogramTests, SinceTest) {
+  stat_trackers::histogram_t histogram;
+  for (int x = 1; x <= 100; ++x) {
+    histogram.record(x);
+  }
+  auto earlier = histogram.snapshot();
+
+  for (int x = 1; x <= 10; ++x) {
+    histogram.record(1000);
+  }
+
+  // Only the values recorded in between are left, their bounds within a bucket
+  auto window = histogram.snapshot().since(earlier);
+  ASSERT_EQ(window.count, 10u);
+  ASSERT_DOUBLE_EQ(window.sum, 10000);
+  ASSERT_NEAR(window.min, 1000, 1000 * 0.125);
+  ASSERT_DOUBLE_EQ(window.max, 1000);
+  ASSERT_NEAR(window.percentile(50), 1000, 1000 * 0.0625);
+
+  ASSERT_EQ(histogram.snapshot().since(histogram.snapshot()).count, 0u);
+}
+
+TEST(HistogramTests, BucketBoundsTest) {
+  // Buckets are contiguous, and every value falls below the upper bound of its bucket
+  double lower_bound = 0;
+  for (int x = 0; x < stat_trackers::histogram_t::buckets; ++x) {
+    auto upper_bound = stat_trackers::histogram_t::bucket_upper_bound(x);
+    ASSERT_GT(upper_bound, lower_bound) << "bucket " << x;
+    lower_bound = upper_bound;
+  }
+
+  stat_trackers::histogram_t histogram;
+  histogram.record(16.6);
+
+  auto snapshot = histogram.snapshot();
+  for (int x = 0; x < stat_trackers::histogram_t::buckets; ++x) {
+    if (snapshot.counts[x]) {
+      ASSERT_GT(stat_trackers::histogram_t::bucket_upper_bound(x), 16.6);
+      ASSERT_LE(stat_trackers::histogram_t::bucket_upper_bound(x - 1), 16.6);
+    }
+  }
+}
+
+TEST(PercentileTrackerTests, CallbackOnIntervalTest) {
+  stat_trackers::percentile_tracker tracker;
+
+  int callbacks = 0;
+  auto callback = [&callbacks](const stat_trackers::histogram_t::snapshot_t &snapshot) {
+    ++callbacks;
+    ASSERT_EQ(snapshot.count, 100u);
+    ASSERT_NEAR(snapshot.percentile(99), 99, 99 * 0.0625);
+    ASSERT_DOUBLE_EQ(snapshot.max, 100);
+  };
+
+  for (int x = 1; x <= 100; ++x) {
+    tracker.collect_and_callback_on_interval(x, callback, std::chrono::seconds(1));
+  }
+  ASSERT_EQ(callbacks, 0);
+
+  // The interval has passed, so the next value reports the previous ones and starts over
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  tracker.collect_and_callback_on_interval(1000, callback, std::chrono::seconds(1));
+  ASSERT_EQ(callbacks, 1);
+}
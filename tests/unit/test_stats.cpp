@@ -0,0 +1,66 @@
+/**
+ * @file tests/unit/test_stats.cpp
+ * @brief Test src/stats.*
+ */
+#include "../tests_common.h"
+
+#include <src/stats.h>
+
+TEST(StatsTests, RegistryTest) {
+  int key;
+  auto session = stats::add_session(&key, "192.168.1.2");
+  ASSERT_EQ(stats::find_session(&key), session);
+
+  stats::remove_session(&key);
+  ASSERT_EQ(stats::find_session(&key), nullptr);
+}
+
+TEST(StatsTests, JsonTest) {
+  int key;
+  auto session = stats::add_session(&key, "192.168.1.2");
+  session->video.sent = 60;
+  session->video.dropped = 2;
+  session->fec_percentage = 20;
+  session->network_latency.record(4);
+
+  auto tree = stats::to_json();
+  stats::remove_session(&key);
+
+  ASSERT_EQ(tree["sessions"].size(), 1u);
+  auto &session_tree = tree["sessions"][0];
+  ASSERT_EQ(session_tree["client"], "192.168.1.2");
+  ASSERT_EQ(session_tree["fec_percentage"], 20);
+  ASSERT_EQ(session_tree["video"]["sent"], 60);
+  ASSERT_EQ(session_tree["video"]["dropped"], 2);
+  ASSERT_EQ(session_tree["latency_ms"]["network"]["count"], 1);
+  ASSERT_DOUBLE_EQ(session_tree["latency_ms"]["network"]["p50"], 4);
+
+  auto &buckets = session_tree["latency_ms"]["network"]["buckets"];
+  ASSERT_EQ(buckets.size(), 1u);
+  ASSERT_GT(buckets[0][0].get<double>(), 4);
+  ASSERT_EQ(buckets[0][1], 1);
+}
+
+TEST(StatsTests, PrometheusTest) {
+  int key;
+  auto session = stats::add_session(&key, "192.168.1.2");
+  session->audio.sent = 100;
+  session->network_latency.record(4);
+  session->network_latency.record(20);
+
+  auto text = stats::to_prometheus();
+  stats::remove_session(&key);
+
+  auto labels = "{session=\"" + std::to_string(session->id) + "\",client=\"192.168.1.2\"}";
+  ASSERT_NE(text.find("# TYPE sunshine_audio_packets_sent_total counter\n"), std::string::npos);
+  ASSERT_NE(text.find("sunshine_audio_packets_sent_total" + labels + " 100\n"), std::string::npos);
+  ASSERT_NE(text.find("sunshine_latency_ms_count{session=\"" + std::to_string(session->id) + "\",client=\"192.168.1.2\",stage=\"encode\"} 0\n"), std::string::npos);
+
+  // Latencies are cumulative histograms, with fixed bucket bounds
+  auto network_labels = "{session=\"" + std::to_string(session->id) + "\",client=\"192.168.1.2\",stage=\"network\"";
+  ASSERT_NE(text.find("# TYPE sunshine_latency_ms histogram\n"), std::string::npos);
+  ASSERT_NE(text.find("sunshine_latency_ms_bucket" + network_labels + ",le=\"4.096\"} 1\n"), std::string::npos);
+  ASSERT_NE(text.find("sunshine_latency_ms_bucket" + network_labels + ",le=\"32.768\"} 2\n"), std::string::npos);
+  ASSERT_NE(text.find("sunshine_latency_ms_bucket" + network_labels + ",le=\"+Inf\"} 2\n"), std::string::npos);
+  ASSERT_NE(text.find("sunshine_latency_ms_sum" + network_labels + "} 24\n"), std::string::npos);
+}
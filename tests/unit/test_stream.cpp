@@ -3,13 +3,27 @@
  * @brief Test src/stream.*
  */
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <span>
 #include <string>
 #include <vector>
 
+extern "C" {
+#include <src/rswrapper.h>
+}
+
+#include <src/video.h>
+
 namespace stream {
+  namespace fec {
+    reed_solomon *codec_for(size_t data_shards, size_t parity_shards);
+  }
+
+  size_t concat_and_insert(uint64_t insert_size, uint64_t slice_size, std::span<const std::string_view> segments, char *destination);
   std::vector<uint8_t> concat_and_insert(uint64_t insert_size, uint64_t slice_size, const std::string_view &data1, const std::string_view &data2);
+  void apply_replacements(std::vector<std::string_view> &segments, const std::vector<video::packet_raw_t::replace_t> &replacements);
 }
 
 #include "../tests_common.h"
@@ -37,3 +51,68 @@ TEST(ConcatAndInsertTests, ConcatSmallStrideTest) {
   auto expected = std::vector<uint8_t> {0, 'a', 0, 'b', 0, 'c', 0, 'd', 0, 'e'};
   ASSERT_EQ(res, expected);
 }
+
+TEST(ConcatAndInsertTests, ConcatSegmentsTest) {
+  std::string_view segments[] = {"ab", "", "cde", "f"};
+  std::vector<uint8_t> res(9, 0xFF);
+  auto bytes = stream::concat_and_insert(1, 2, segments, (char *) res.data());
+  auto expected = std::vector<uint8_t> {0, 'a', 'b', 0, 'c', 'd', 0, 'e', 'f'};
+  ASSERT_EQ(bytes, expected.size());
+  ASSERT_EQ(res, expected);
+}
+
+TEST(ConcatAndInsertTests, ConcatSegmentsReplacedAcrossBoundaryTest) {
+  std::vector<std::string_view> segments {"", "abXY", "Z", "cdVW", "e"};
+  std::vector<video::packet_raw_t::replace_t> replacements;
+  replacements.emplace_back("XYZc", "1");
+  replacements.emplace_back("VWe", "23");
+  stream::apply_replacements(segments, replacements);
+
+  std::vector<uint8_t> res(14, 0xFF);
+  auto bytes = stream::concat_and_insert(1, 2, segments, (char *) res.data());
+  auto expected = std::vector<uint8_t> {0, 'a', 'b', 0, '1', 'd', 0, '2', '3'};
+  ASSERT_EQ(bytes, expected.size());
+  res.resize(bytes);
+  ASSERT_EQ(res, expected);
+}
+
+TEST(FecCodecCacheTests, CodecReuseTest) {
+  reed_solomon_init();
+
+  auto rs = stream::fec::codec_for(100, 20);
+  ASSERT_NE(rs, nullptr);
+  ASSERT_EQ(stream::fec::codec_for(100, 20), rs);
+  ASSERT_NE(stream::fec::codec_for(20, 100), rs);
+}
+
+TEST(FecCodecCacheTests, CachedCodecMatchesUncachedTest) {
+  reed_solomon_init();
+
+  constexpr size_t data_shards = 90;
+  constexpr size_t parity_shards = 18;
+  constexpr size_t blocksize = 1392 + 16;
+
+  std::vector<uint8_t> buffer((data_shards + parity_shards) * blocksize);
+  for (size_t x = 0; x < buffer.size(); ++x) {
+    buffer[x] = (uint8_t) (x * 31);
+  }
+
+  std::vector<uint8_t *> shards_p(data_shards + parity_shards);
+  for (size_t x = 0; x < shards_p.size(); ++x) {
+    shards_p[x] = &buffer[x * blocksize];
+  }
+
+  auto rs = reed_solomon_new(data_shards, parity_shards);
+  reed_solomon_encode(rs, shards_p.data(), shards_p.size(), blocksize);
+  reed_solomon_release(rs);
+  std::vector<uint8_t> expected_parity(buffer.begin() + data_shards * blocksize, buffer.end());
+
+  // Encode twice, so the second run reuses the codec cached by the first
+  for (int x = 0; x < 2; ++x) {
+    std::fill(buffer.begin() + data_shards * blocksize, buffer.end(), 0);
+    reed_solomon_encode(stream::fec::codec_for(data_shards, parity_shards), shards_p.data(), shards_p.size(), blocksize);
+
+    std::vector<uint8_t> parity(buffer.begin() + data_shards * blocksize, buffer.end());
+    ASSERT_EQ(parity, expected_parity);
+  }
+}
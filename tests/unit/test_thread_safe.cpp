@@ -0,0 +1,175 @@
+/**
+ * @file tests/unit/test_thread_safe.cpp
+ * @brief Test src/thread_safe.*
+ */
+#include "../tests_common.h"
+
+#include <chrono>
+#include <src/thread_safe.h>
+#include <thread>
+
+TEST(QueueTests, PopsInOrderTest) {
+  safe::queue_t<int> queue {4};
+
+  for (int x = 0; x < 10; ++x) {
+    ASSERT_TRUE(queue.raise(x));
+    ASSERT_EQ(*queue.pop(), x);
+  }
+}
+
+TEST(QueueTests, DropOldestTest) {
+  safe::queue_t<int> queue {3, safe::overflow_e::drop_oldest};
+
+  ASSERT_TRUE(queue.raise(1));
+  ASSERT_TRUE(queue.raise(2));
+  ASSERT_TRUE(queue.raise(3));
+  ASSERT_FALSE(queue.raise(4));
+
+  ASSERT_EQ(queue.drain(), (std::vector<int> {2, 3, 4}));
+}
+
+TEST(QueueTests, DropNewestTest) {
+  safe::queue_t<int> queue {3, safe::overflow_e::drop_newest};
+
+  ASSERT_TRUE(queue.raise(1));
+  ASSERT_TRUE(queue.raise(2));
+  ASSERT_TRUE(queue.raise(3));
+  ASSERT_FALSE(queue.raise(4));
+
+  ASSERT_EQ(queue.drain(), (std::vector<int> {1, 2, 3}));
+}
+
+TEST(QueueTests, BlockTest) {
+  safe::queue_t<int> queue {1, safe::overflow_e::block};
+
+  ASSERT_TRUE(queue.raise(1));
+
+  std::thread producer {[&queue]() {
+    queue.raise(2);
+  }};
+
+  ASSERT_EQ(*queue.pop(), 1);
+  ASSERT_EQ(*queue.pop(), 2);
+
+  producer.join();
+}
+
+TEST(QueueTests, StopWakesConsumerTest) {
+  safe::queue_t<int> queue;
+
+  std::thread consumer {[&queue]() {
+    ASSERT_FALSE(queue.pop());
+  }};
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  queue.stop();
+  consumer.join();
+
+  ASSERT_FALSE(queue.raise(1));
+}
+
+TEST(QueueTests, OnRaiseTest) {
+  safe::queue_t<int> queue;
+
+  int notified = 0;
+  queue.on_raise([&notified]() {
+    ++notified;
+  });
+
+  queue.raise(1);
+  queue.raise(2);
+  ASSERT_EQ(notified, 2);
+
+  queue.on_raise(nullptr);
+  queue.raise(3);
+  ASSERT_EQ(notified, 2);
+}
+
+TEST(EventTests, OnRaiseTest) {
+  safe::event_t<bool> event;
+
+  int notified = 0;
+  event.on_raise([&notified]() {
+    ++notified;
+  });
+
+  event.raise(true);
+  ASSERT_EQ(notified, 1);
+  ASSERT_TRUE(event.peek());
+}
+
+TEST(SpscQueueTests, PopsInOrderTest) {
+  safe::spsc_queue_t<int> queue {8, safe::overflow_e::block};
+
+  constexpr int elements = 100000;
+  std::thread producer {[&queue]() {
+    for (int x = 0; x < elements; ++x) {
+      queue.raise(x);
+    }
+  }};
+
+  for (int x = 0; x < elements; ++x) {
+    ASSERT_EQ(*queue.pop(), x);
+  }
+
+  producer.join();
+}
+
+TEST(SpscQueueTests, DropNewestTest) {
+  safe::spsc_queue_t<int> queue {2};
+
+  ASSERT_TRUE(queue.raise(1));
+  ASSERT_TRUE(queue.raise(2));
+  ASSERT_FALSE(queue.raise(3));
+
+  ASSERT_EQ(*queue.pop(), 1);
+  ASSERT_EQ(*queue.pop(), 2);
+  ASSERT_FALSE(queue.peek());
+}
+
+TEST(SpscQueueTests, StopWakesConsumerTest) {
+  safe::spsc_queue_t<int> queue;
+
+  std::thread consumer {[&queue]() {
+    ASSERT_FALSE(queue.pop());
+  }};
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  queue.stop();
+  consumer.join();
+}
+
+TEST(QueueTests, ContentionTest) {
+  constexpr int producers = 4;
+  constexpr int elements_per_producer = 10000;
+
+  safe::queue_t<int> queue {32, safe::overflow_e::block};
+
+  std::vector<std::thread> threads;
+  for (int x = 0; x < producers; ++x) {
+    threads.emplace_back([&queue, x]() {
+      for (int y = 0; y < elements_per_producer; ++y) {
+        queue.raise(x * elements_per_producer + y);
+      }
+    });
+  }
+
+  std::vector<int> popped;
+  for (int x = 0; x < producers * elements_per_producer; ++x) {
+    auto element = queue.pop();
+    popped.push_back(element ? *element : -1);
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Blocking producers never drop anything, and each producer's elements arrive in order
+  std::vector<int> next(producers, 0);
+  for (auto element : popped) {
+    ASSERT_GE(element, 0);
+    ASSERT_EQ(element % elements_per_producer, next[element / elements_per_producer]++);
+  }
+
+  ASSERT_FALSE(queue.peek());
+}
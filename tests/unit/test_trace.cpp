@@ -0,0 +1,123 @@
+/**
+ * @file tests/unit/test_trace.cpp
+ * @brief Test src/trace.*
+ */
+#include "../tests_common.h"
+
+#include <nlohmann/json.hpp>
+#include <src/trace.h>
+#include <thread>
+
+namespace {
+  /**
+   * @brief Get the events of the trace that have the given name.
+   */
+  std::vector<nlohmann::json> events_named(std::string_view name) {
+    auto tree = nlohmann::json::parse(trace::to_chrome_json());
+
+    std::vector<nlohmann::json> events;
+    for (auto &event : tree["traceEvents"]) {
+      if (event["name"].get<std::string>() == name) {
+        events.emplace_back(event);
+      }
+    }
+
+    return events;
+  }
+
+  class TraceTest: public ::testing::Test {
+  protected:
+    void SetUp() override {
+      trace::enable(true);
+    }
+
+    void TearDown() override {
+      trace::enable(false);
+    }
+  };
+}  // namespace
+
+TEST_F(TraceTest, DisabledRecordsNothingTest) {
+  trace::enable(false);
+  {
+    trace::span_t span {"disabled_span", 1};
+  }
+
+  ASSERT_TRUE(events_named("disabled_span").empty());
+}
+
+TEST_F(TraceTest, ChromeTraceFormatTest) {
+  int session_a;
+  int session_b;
+
+  auto start = std::chrono::steady_clock::now();
+  trace::record("format_span", start, start + std::chrono::microseconds(250), 7, &session_a);
+  trace::record("format_span", start, start + std::chrono::microseconds(250), 8, &session_b);
+  trace::record("format_span", start, start + std::chrono::microseconds(250), 9, &session_a);
+
+  auto events = events_named("format_span");
+  ASSERT_EQ(events.size(), 3u);
+
+  ASSERT_EQ(events[0]["ph"], "X");
+  ASSERT_DOUBLE_EQ(events[0]["dur"].get<double>(), 250.0);
+  ASSERT_EQ(events[0]["args"]["frame"], 7);
+  ASSERT_EQ(events[1]["args"]["frame"], 8);
+
+  // Sessions are numbered, and the same session keeps its number
+  ASSERT_NE(events[0]["args"]["session"], events[1]["args"]["session"]);
+  ASSERT_EQ(events[0]["args"]["session"], events[2]["args"]["session"]);
+}
+
+TEST_F(TraceTest, ThreadsHaveOwnTracksTest) {
+  {
+    trace::span_t span {"track_span"};
+  }
+
+  std::thread thread {[]() {
+    trace::span_t span {"track_span"};
+  }};
+  thread.join();
+
+  auto events = events_named("track_span");
+  ASSERT_EQ(events.size(), 2u);
+  ASSERT_NE(events[0]["tid"], events[1]["tid"]);
+}
+
+TEST_F(TraceTest, KeepsMostRecentEventsTest) {
+  // Use a fresh thread, so its buffer only holds these events
+  std::thread thread {[]() {
+    auto now = std::chrono::steady_clock::now();
+    for (std::size_t x = 0; x < trace::events_per_thread + 100; ++x) {
+      trace::record("ring_span", now, now, (std::int64_t) x);
+    }
+  }};
+  thread.join();
+
+  auto events = events_named("ring_span");
+  ASSERT_EQ(events.size(), trace::events_per_thread);
+  ASSERT_EQ(events.front()["args"]["frame"], 100);
+  ASSERT_EQ(events.back()["args"]["frame"], trace::events_per_thread + 99);
+}
+
+TEST_F(TraceTest, ConcurrentReadIsConsistentTest) {
+  std::atomic_bool done {false};
+  std::thread writer {[&done]() {
+    for (std::int64_t x = 0; x < 200000; ++x) {
+      auto now = std::chrono::steady_clock::now();
+      trace::record("concurrent_span", now, now, x);
+    }
+    done = true;
+  }};
+
+  // Every event a reader sees must be complete, so frames only ever increase
+  while (!done) {
+    std::int64_t last_frame = -1;
+    for (auto &event : events_named("concurrent_span")) {
+      auto frame = event["args"]["frame"].get<std::int64_t>();
+      ASSERT_GT(frame, last_frame);
+      last_frame = frame;
+    }
+  }
+
+  writer.join();
+}